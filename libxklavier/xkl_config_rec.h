@@ -21,6 +21,7 @@
 #define __XKL_CONFIG_REC_H__
 
 #include <glib-object.h>
+#include <gio/gio.h>
 #include <libxklavier/xkl_engine.h>
 
 #ifdef __cplusplus
@@ -110,6 +111,113 @@ extern "C" {
 	extern gboolean xkl_config_rec_activate(const XklConfigRec * data,
 						XklEngine * engine);
 
+/**
+ * xkl_config_rec_activate_async:
+ * @data: valid XKB configuration
+ * @engine: the engine
+ * @cancellable: (allow-none): optional #GCancellable object, NULL to ignore
+ * @callback: (scope async): a #GAsyncReadyCallback to call when the
+ * configuration is activated
+ * @user_data: (closure): the data to pass to the callback
+ *
+ * Activates some XKB configuration without blocking the caller while
+ * the keymap is compiled. The keymap is compiled in a separate thread,
+ * then sent to the server from the thread-default main context of the
+ * caller, just before @callback is invoked. Backends which cannot
+ * compile in the background activate the configuration right away.
+ * If the operation is cancelled before the keymap is sent, the server
+ * configuration is left untouched and the operation fails with
+ * G_IO_ERROR_CANCELLED.
+ * Call xkl_config_rec_activate_finish() from @callback to get the result.
+ */
+	extern void xkl_config_rec_activate_async(const XklConfigRec * data,
+						  XklEngine * engine,
+						  GCancellable *
+						  cancellable,
+						  GAsyncReadyCallback
+						  callback,
+						  gpointer user_data);
+
+/**
+ * xkl_config_rec_activate_finish:
+ * @engine: the engine
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for a #GError, or NULL
+ *
+ * Finishes the activation started by xkl_config_rec_activate_async().
+ * A configuration which could not be activated gives G_IO_ERROR_FAILED,
+ * with the reason in the message; a cancelled operation gives
+ * G_IO_ERROR_CANCELLED.
+ *
+ * Returns: TRUE on success, FALSE if @error is set
+ */
+	extern gboolean xkl_config_rec_activate_finish(XklEngine * engine,
+						       GAsyncResult *
+						       result,
+						       GError ** error);
+
+/**
+ * xkl_config_rec_precompile:
+ * @data: XKB configuration which is likely to be activated soon
+ * @engine: the engine
+ *
+ * Queues the keymap of the configuration for compilation in the
+ * background, so that activating it later takes the keymap from the
+ * cache. Meant for the configurations the user is editing. Only one
+ * keymap is compiled at a time, with a lowered priority, and only a
+ * few keymaps can be waiting; the keymaps which are already cached or
+ * queued are skipped. The cache keeps the recently used keymaps within
+ * a fixed size.
+ *
+ * Returns: TRUE if the keymap is cached or queued, FALSE if the backend
+ * does not compile keymaps, the configuration cannot be resolved or
+ * the queue is full
+ */
+	extern gboolean xkl_config_rec_precompile(const XklConfigRec * data,
+						  XklEngine * engine);
+
+/**
+ * XklConfigRecValidity:
+ * @XKL_CONFIG_REC_VALID: the configuration is resolved by the rules
+ * (and compiled, if asked)
+ * @XKL_CONFIG_REC_NO_RULES: the rules could not be loaded
+ * @XKL_CONFIG_REC_NOT_RESOLVED: the rules do not resolve the
+ * configuration into the keymap components
+ * @XKL_CONFIG_REC_NOT_COMPILED: the keymap could not be compiled
+ *
+ * The result of xkl_config_rec_validate()
+ */
+	typedef enum {
+		XKL_CONFIG_REC_VALID,
+		XKL_CONFIG_REC_NO_RULES,
+		XKL_CONFIG_REC_NOT_RESOLVED,
+		XKL_CONFIG_REC_NOT_COMPILED
+	} XklConfigRecValidity;
+
+/**
+ * xkl_config_rec_validate:
+ * @data: XKB configuration to check
+ * @ruleset: (allow-none): the XKB rules set, NULL for the default one
+ * @compile: whether the keymap should be compiled as well
+ *
+ * Checks the configuration without an X server: resolves it through
+ * the (cached) XKB rules and, if asked, compiles the keymap into the
+ * keymap cache. No other files are written and no global state but
+ * the caches is changed, so many configurations can be checked from
+ * several threads at once. The reason of a failure is only returned,
+ * xkl_get_last_error() is not set.
+ *
+ * Returns: XKL_CONFIG_REC_VALID if the configuration is usable, the
+ * reason why it is not otherwise
+ */
+	extern XklConfigRecValidity xkl_config_rec_validate(const
+							    XklConfigRec *
+							    data,
+							    const gchar *
+							    ruleset,
+							    gboolean
+							    compile);
+
 /**
  * xkl_config_rec_get_from_server:
  * @data: buffer for XKB configuration
@@ -154,6 +262,65 @@ extern "C" {
 						     const gboolean
 						     binary);
 
+/**
+ * XklConfigRecExportJob:
+ * @data: valid XKB configuration
+ * @file_name: name of the file to create
+ * @binary: flag indicating whether the output file should be binary
+ * @written: set to TRUE once the file is written
+ * @error: why the file could not be written, NULL if it was
+ *
+ * One file to write by xkl_config_rec_write_to_files()
+ */
+	typedef struct _XklConfigRecExportJob XklConfigRecExportJob;
+	struct _XklConfigRecExportJob {
+		XklConfigRec *data;
+		const gchar *file_name;
+		gboolean binary;
+		gboolean written;
+		const gchar *error;
+	};
+
+/**
+ * XklConfigRecExportFunc:
+ * @job: the job just finished
+ * @done: how many jobs are finished so far
+ * @total: how many jobs there are
+ * @data: anything which can be stored into the pointer
+ *
+ * Callback type used for reporting the progress of
+ * xkl_config_rec_write_to_files()
+ */
+	typedef void (*XklConfigRecExportFunc) (const XklConfigRecExportJob *
+						job, guint done,
+						guint total,
+						gpointer data);
+
+/**
+ * xkl_config_rec_write_to_files:
+ * @engine: the engine
+ * @jobs: (array length=n_jobs): the files to write
+ * @n_jobs: the number of the files
+ * @max_processes: how many keymaps may be compiled at once, 0 for as
+ * many as there are processors
+ * @func: (scope call) (allow-none): callback to call for every finished
+ * job, NULL to ignore
+ * @data: anything which can be stored into the pointer
+ *
+ * Writes many XKB configurations into XKM/XKB/... files, like
+ * xkl_config_rec_write_to_file() does for one. The keymaps are compiled
+ * in parallel, the files are written in the order the keymaps are
+ * ready. The result of every job is stored in it.
+ *
+ * Returns: the number of the files written
+ */
+	extern guint xkl_config_rec_write_to_files(XklEngine * engine,
+						   XklConfigRecExportJob *
+						   jobs, guint n_jobs,
+						   guint max_processes,
+						   XklConfigRecExportFunc
+						   func, gpointer data);
+
 /**
  * xkl_config_rec_get_from_root_window_property:
  * @rules_atom_name: atom name of the root window property to read
@@ -91,7 +91,9 @@ extern "C" {
  * should be loaded as well
  *
  * Loads XML configuration registry. The name is taken from X server
- * (for XKB/libxkbfile, from the root window property)
+ * (for XKB/libxkbfile, from the root window property).
+ * A valid snapshot made by xkl-registry-compile is taken instead of
+ * the XML files, if there is one for the current locale.
  *
  * Returns: TRUE on success
  */
@@ -100,6 +102,125 @@ extern "C" {
 						 gboolean
 						 if_extras_needed);
 
+/**
+ * xkl_config_registry_load_from_bytes:
+ * @config: the config registry
+ * @registry: contents of the main registry document
+ * @extras: (allow-none): contents of the extras document, or NULL
+ *
+ * Loads XML configuration registry from memory, without touching the
+ * file system. The data can be plain XML, or gzip or zstd compressed
+ * XML (which is decompressed on the fly, if the support is compiled in).
+ * The buffers are not referenced after the call returns.
+ *
+ * Returns: TRUE on success
+ */
+	extern gboolean xkl_config_registry_load_from_bytes(XklConfigRegistry
+							    * config,
+							    GBytes *
+							    registry,
+							    GBytes *
+							    extras);
+
+/**
+ * xkl_config_registry_load_from_fd:
+ * @config: the config registry
+ * @fd: file descriptor to read the main registry document from
+ * @extras_fd: file descriptor to read the extras document from, or -1
+ *
+ * Loads XML configuration registry reading the descriptors till EOF.
+ * Pipes and sockets are fine. Compressed data is recognized just like
+ * in xkl_config_registry_load_from_bytes(). The descriptors are not
+ * closed.
+ *
+ * Returns: TRUE on success
+ */
+	extern gboolean xkl_config_registry_load_from_fd(XklConfigRegistry *
+							 config, gint fd,
+							 gint extras_fd);
+
+/**
+ * xkl_config_registry_load_from_path:
+ * @config: the config registry
+ * @file_name: path of the main registry document
+ * @extras_file_name: (allow-none): path of the extras document, or NULL
+ *
+ * Loads XML configuration registry from the given files instead of the
+ * ones for the current ruleset. The files can be compressed, the
+ * contents are recognized by the signature, not by the name.
+ *
+ * Returns: TRUE on success
+ */
+	extern gboolean xkl_config_registry_load_from_path(XklConfigRegistry
+							   * config,
+							   const gchar *
+							   file_name,
+							   const gchar *
+							   extras_file_name);
+
+/**
+ * xkl_config_registry_save_snapshot:
+ * @config: the config registry
+ * @file_name: path of the snapshot to write
+ *
+ * Saves the loaded registry as a binary snapshot: all the items with
+ * their descriptions translated for the current locale, the names of
+ * the countries and languages they refer to and the data of the search.
+ * The snapshot remembers the files it is made of, together with the
+ * iso-codes ones and the message catalogs of the translations, and is
+ * valid only as long as they do not change.
+ * The locale is the one of LC_MESSAGES, without the codeset; saving
+ * fails if LANGUAGE names the locales other than that one and its
+ * fallbacks.
+ *
+ * Returns: TRUE on success
+ */
+	extern gboolean xkl_config_registry_save_snapshot(XklConfigRegistry
+							  * config,
+							  const gchar *
+							  file_name);
+
+/**
+ * xkl_config_registry_load_snapshot:
+ * @config: the config registry
+ * @file_name: path of the snapshot
+ *
+ * Loads the registry from a snapshot written by
+ * xkl_config_registry_save_snapshot(). The snapshot is refused if it is
+ * made for another locale, if LANGUAGE names the locales other than
+ * the current one and its fallbacks or if the files it is made of have
+ * changed.
+ *
+ * Returns: TRUE on success
+ */
+	extern gboolean xkl_config_registry_load_snapshot(XklConfigRegistry
+							  * config,
+							  const gchar *
+							  file_name);
+
+/**
+ * xkl_config_registry_compile_snapshot:
+ * @base_dir: the directory of the registry files
+ * @ruleset: the ruleset, "base" or "evdev" for example
+ * @if_extras_needed: whether exotic materials (layouts, options,
+ * variants) are to be included
+ * @snapshot_dir: the directory to write the snapshot to
+ *
+ * Writes the snapshot xkl_config_registry_load() looks for before
+ * reading the XML files of the ruleset, for the current locale.
+ * No engine is needed, so the snapshots can be made at install time.
+ *
+ * Returns: TRUE on success
+ */
+	extern gboolean xkl_config_registry_compile_snapshot(const gchar *
+							     base_dir,
+							     const gchar *
+							     ruleset,
+							     gboolean
+							     if_extras_needed,
+							     const gchar *
+							     snapshot_dir);
+
 /**
  * XklConfigItemProcessFunc:
  * @config: the config registry
@@ -208,6 +329,24 @@ extern "C" {
 						       func,
 						       gpointer data);
 
+/**
+ * xkl_config_registry_foreach_option_group_with_options:
+ * @config: the config registry
+ * @func: (scope call): callback to call for every option group and option
+ * @data: anything which can be stored into the pointer
+ *
+ * Enumerates all the option groups with their options in one pass.
+ * For every group, the callback is called once with the group as
+ * @item and NULL as @subitem, then once per option of the group,
+ * with the option as @subitem. The group items carry
+ * XCI_PROP_ALLOW_MULTIPLE_SELECTION, as in
+ * xkl_config_registry_foreach_option_group().
+ */
+	extern void
+	 xkl_config_registry_foreach_option_group_with_options
+	    (XklConfigRegistry * config, XklTwoConfigItemsProcessFunc func,
+	     gpointer data);
+
 /**
  * xkl_config_registry_find_model:
  * @config: the config registry
@@ -292,6 +431,36 @@ extern "C" {
 							XklConfigItem *
 							item);
 
+/**
+ * xkl_config_registry_get_group_items:
+ * @config: the config registry
+ * @group: the group number, as in xkl_engine_get_groups_names
+ * @layout_item: (out) (transfer none) (allow-none): the layout
+ * of the group
+ * @variant_item: (out) (transfer none) (allow-none): the layout variant
+ * of the group, NULL if the group uses the default variant
+ *
+ * Gets the registry items (descriptions, country and language lists)
+ * for the layout and variant of the group in the current keyboard
+ * configuration. The items are resolved on the first call after a
+ * configuration change, so this function is cheap enough to be called
+ * on every group switch, and gives the new items to any handler of the
+ * "X-config-changed" signal of the engine.
+ * The items belong to the registry and are valid until the next
+ * configuration change.
+ *
+ * Returns: TRUE if the layout of the group was found in the registry
+ */
+	extern gboolean xkl_config_registry_get_group_items(XklConfigRegistry
+							    * config,
+							    gint group,
+							    const
+							    XklConfigItem **
+							    layout_item,
+							    const
+							    XklConfigItem **
+							    variant_item);
+
 /**
  * xkl_config_registry_foreach_country:
  * @config: the config registry
@@ -378,6 +547,327 @@ extern "C" {
 					       XklTwoConfigItemsProcessFunc
 					       func, gpointer data);
 
+/**
+ * xkl_config_registry_search_fuzzy:
+ * @config: the config registry
+ * @pattern: words to search for (NULL means "all")
+ * @max_distance: maximum number of typos per word, -1 for the default (2)
+ * @func: (scope call): callback to call for every matching layout/variant
+ * @data: anything which can be stored into the pointer
+ *
+ * Same as xkl_config_registry_search_by_pattern(), but tolerant to typos:
+ * a word of the pattern matches if it is within @max_distance
+ * insertions, deletions or substitutions from a part of some word of
+ * the description or the country/language name. Short words of the
+ * pattern are allowed fewer typos (one per 4 characters), so that
+ * "germn" finds German layouts while "us" does not find everything.
+ */
+	extern void
+	 xkl_config_registry_search_fuzzy(XklConfigRegistry * config,
+					  const gchar * pattern,
+					  gint max_distance,
+					  XklTwoConfigItemsProcessFunc func,
+					  gpointer data);
+
+/**
+ * xkl_config_registry_set_max_search_threads:
+ * @config: the config registry
+ * @max_threads: maximum number of threads, 0 for one per processor
+ *
+ * Allows xkl_config_registry_search_by_pattern() to check the layouts
+ * in parallel, using up to @max_threads threads. The callback is still
+ * called in the calling thread and in the registry order.
+ * The threads are started by the first parallel search and kept by the
+ * registry for the next ones.
+ * By default the search is not parallel (1 thread).
+ */
+	extern void
+	 xkl_config_registry_set_max_search_threads(XklConfigRegistry *
+						    config,
+						    gint max_threads);
+
+/**
+ * xkl_config_registry_get_max_search_threads:
+ * @config: the config registry
+ *
+ * Returns: maximum number of threads used by the search by pattern,
+ * 0 for one per processor
+ */
+	extern gint
+	 xkl_config_registry_get_max_search_threads(XklConfigRegistry *
+						    config);
+
+/**
+ * XklConfigFilterTarget:
+ * @XKL_CONFIG_FILTER_MODELS: keyboard models
+ * @XKL_CONFIG_FILTER_LAYOUTS: keyboard layouts
+ * @XKL_CONFIG_FILTER_VARIANTS: layout variants
+ * @XKL_CONFIG_FILTER_OPTION_GROUPS: option groups
+ * @XKL_CONFIG_FILTER_OPTIONS: options
+ *
+ * The kind of registry items the filter is applied to
+ */
+	typedef enum {
+		XKL_CONFIG_FILTER_MODELS = 0,
+		XKL_CONFIG_FILTER_LAYOUTS,
+		XKL_CONFIG_FILTER_VARIANTS,
+		XKL_CONFIG_FILTER_OPTION_GROUPS,
+		XKL_CONFIG_FILTER_OPTIONS
+	} XklConfigFilterTarget;
+
+/**
+ * XklConfigFilter:
+ *
+ * Opaque structure describing the set of conditions registry
+ * items have to satisfy. All the conditions set are combined
+ * (an item matches if it satisfies all of them).
+ */
+	typedef struct _XklConfigFilter XklConfigFilter;
+
+#define XKL_TYPE_CONFIG_FILTER (xkl_config_filter_get_type())
+
+/**
+ * xkl_config_filter_get_type:
+ *
+ * Get type info for XklConfigFilter
+ *
+ * Returns: GType for XklConfigFilter
+ */
+	extern GType xkl_config_filter_get_type(void);
+
+/**
+ * xkl_config_filter_new:
+ * @target: the kind of items to look for
+ *
+ * Creates new filter, matching all the items of the given kind
+ *
+ * Returns: (transfer full): new filter
+ */
+	extern XklConfigFilter *xkl_config_filter_new(XklConfigFilterTarget
+						      target);
+
+/**
+ * xkl_config_filter_copy:
+ * @filter: the filter to copy
+ *
+ * Copies the filter
+ *
+ * Returns: (transfer full): the copy of the filter
+ */
+	extern XklConfigFilter *xkl_config_filter_copy(const XklConfigFilter
+						       * filter);
+
+/**
+ * xkl_config_filter_free:
+ * @filter: the filter to free
+ *
+ * Frees the filter
+ */
+	extern void xkl_config_filter_free(XklConfigFilter * filter);
+
+/**
+ * xkl_config_filter_set_vendor:
+ * @filter: the filter
+ * @vendor: (allow-none): the vendor of the item (NULL means "any")
+ *
+ * Requires the item to have the given vendor (usually used for models)
+ */
+	extern void xkl_config_filter_set_vendor(XklConfigFilter * filter,
+						 const gchar * vendor);
+
+/**
+ * xkl_config_filter_set_country:
+ * @filter: the filter
+ * @country_code: (allow-none): ISO 3166 country code
+ * (NULL means "any")
+ *
+ * Requires the item to have the country in its country list.
+ * The variants without their own country list are checked against
+ * the list of their layout.
+ */
+	extern void xkl_config_filter_set_country(XklConfigFilter * filter,
+						  const gchar *
+						  country_code);
+
+/**
+ * xkl_config_filter_set_language:
+ * @filter: the filter
+ * @language_code: (allow-none): ISO 639 language code
+ * (NULL means "any")
+ *
+ * Requires the item to have the language in its language list.
+ * The variants without their own language list are checked against
+ * the list of their layout.
+ */
+	extern void xkl_config_filter_set_language(XklConfigFilter *
+						   filter,
+						   const gchar *
+						   language_code);
+
+/**
+ * xkl_config_filter_set_extra_item:
+ * @filter: the filter
+ * @extra_item: whether the item has to come from the "extras" part
+ * of the registry (TRUE) or from the main one (FALSE)
+ *
+ * Requires the item to be (or not to be) an extra item
+ */
+	extern void xkl_config_filter_set_extra_item(XklConfigFilter *
+						     filter,
+						     gboolean extra_item);
+
+/**
+ * xkl_config_filter_set_parent:
+ * @filter: the filter
+ * @parent_name: (allow-none): the name of the layout (for variants) or
+ * the option group (for options), NULL means "any"
+ *
+ * Requires the item to belong to the given layout or option group.
+ * Models, layouts and option groups never match this condition.
+ */
+	extern void xkl_config_filter_set_parent(XklConfigFilter * filter,
+						 const gchar *
+						 parent_name);
+
+/**
+ * xkl_config_filter_set_name_prefix:
+ * @filter: the filter
+ * @prefix: (allow-none): the beginning of the item name
+ * (NULL means "any")
+ *
+ * Requires the name of the item to start with the prefix
+ */
+	extern void xkl_config_filter_set_name_prefix(XklConfigFilter *
+						      filter,
+						      const gchar *
+						      prefix);
+
+/**
+ * xkl_config_registry_foreach_filtered:
+ * @config: the config registry
+ * @filter: the filter to apply
+ * @func: (scope call): callback to call for every matching item
+ * @data: anything which can be stored into the pointer
+ *
+ * Enumerates the registry items matching the filter. The filter is
+ * evaluated over the registry tables loaded in memory, the callback
+ * is only called for the matching items.
+ * For variants and options the callback gets the layout/option group
+ * as @item and the variant/option as @subitem, for other
+ * items @subitem is NULL.
+ */
+	extern void xkl_config_registry_foreach_filtered(XklConfigRegistry *
+							 config,
+							 const
+							 XklConfigFilter *
+							 filter,
+							 XklTwoConfigItemsProcessFunc
+							 func,
+							 gpointer data);
+
+/**
+ * XklConfigRegistryStat:
+ * @XKL_CONFIG_REGISTRY_STAT_LOAD_PARSE: parsing the XML documents
+ * @XKL_CONFIG_REGISTRY_STAT_LOAD_XPATH: creating the XPath contexts
+ * @XKL_CONFIG_REGISTRY_STAT_LOAD_INDEX: building the in-memory tables
+ * from the XML documents
+ * @XKL_CONFIG_REGISTRY_STAT_LOAD_SNAPSHOT: loading a snapshot
+ * @XKL_CONFIG_REGISTRY_STAT_READ_ITEM: reading an item from the XML
+ * @XKL_CONFIG_REGISTRY_STAT_TRANSLATE: translating the item descriptions
+ * @XKL_CONFIG_REGISTRY_STAT_FOREACH_MODEL:
+ * xkl_config_registry_foreach_model()
+ * @XKL_CONFIG_REGISTRY_STAT_FOREACH_LAYOUT:
+ * xkl_config_registry_foreach_layout()
+ * @XKL_CONFIG_REGISTRY_STAT_FOREACH_LAYOUT_VARIANT:
+ * xkl_config_registry_foreach_layout_variant()
+ * @XKL_CONFIG_REGISTRY_STAT_FOREACH_OPTION_GROUP:
+ * xkl_config_registry_foreach_option_group()
+ * @XKL_CONFIG_REGISTRY_STAT_FOREACH_OPTION:
+ * xkl_config_registry_foreach_option()
+ * @XKL_CONFIG_REGISTRY_STAT_FOREACH_OPTION_GROUP_WITH_OPTIONS:
+ * xkl_config_registry_foreach_option_group_with_options()
+ * @XKL_CONFIG_REGISTRY_STAT_FOREACH_COUNTRY:
+ * xkl_config_registry_foreach_country()
+ * @XKL_CONFIG_REGISTRY_STAT_FOREACH_LANGUAGE:
+ * xkl_config_registry_foreach_language()
+ * @XKL_CONFIG_REGISTRY_STAT_FOREACH_COUNTRY_VARIANT:
+ * xkl_config_registry_foreach_country_variant()
+ * @XKL_CONFIG_REGISTRY_STAT_FOREACH_LANGUAGE_VARIANT:
+ * xkl_config_registry_foreach_language_variant()
+ * @XKL_CONFIG_REGISTRY_STAT_FOREACH_FILTERED:
+ * xkl_config_registry_foreach_filtered()
+ * @XKL_CONFIG_REGISTRY_STAT_FIND_MODEL: xkl_config_registry_find_model()
+ * @XKL_CONFIG_REGISTRY_STAT_FIND_LAYOUT: xkl_config_registry_find_layout()
+ * @XKL_CONFIG_REGISTRY_STAT_FIND_VARIANT:
+ * xkl_config_registry_find_variant()
+ * @XKL_CONFIG_REGISTRY_STAT_FIND_OPTION_GROUP:
+ * xkl_config_registry_find_option_group()
+ * @XKL_CONFIG_REGISTRY_STAT_FIND_OPTION: xkl_config_registry_find_option()
+ * @XKL_CONFIG_REGISTRY_STAT_SEARCH_BY_PATTERN:
+ * xkl_config_registry_search_by_pattern()
+ * @XKL_CONFIG_REGISTRY_STAT_SEARCH_FUZZY:
+ * xkl_config_registry_search_fuzzy()
+ * @XKL_CONFIG_REGISTRY_NUM_STATS: the number of the counters
+ *
+ * The operations the registry counts and times
+ */
+	typedef enum {
+		XKL_CONFIG_REGISTRY_STAT_LOAD_PARSE = 0,
+		XKL_CONFIG_REGISTRY_STAT_LOAD_XPATH,
+		XKL_CONFIG_REGISTRY_STAT_LOAD_INDEX,
+		XKL_CONFIG_REGISTRY_STAT_LOAD_SNAPSHOT,
+		XKL_CONFIG_REGISTRY_STAT_READ_ITEM,
+		XKL_CONFIG_REGISTRY_STAT_TRANSLATE,
+		XKL_CONFIG_REGISTRY_STAT_FOREACH_MODEL,
+		XKL_CONFIG_REGISTRY_STAT_FOREACH_LAYOUT,
+		XKL_CONFIG_REGISTRY_STAT_FOREACH_LAYOUT_VARIANT,
+		XKL_CONFIG_REGISTRY_STAT_FOREACH_OPTION_GROUP,
+		XKL_CONFIG_REGISTRY_STAT_FOREACH_OPTION,
+		XKL_CONFIG_REGISTRY_STAT_FOREACH_OPTION_GROUP_WITH_OPTIONS,
+		XKL_CONFIG_REGISTRY_STAT_FOREACH_COUNTRY,
+		XKL_CONFIG_REGISTRY_STAT_FOREACH_LANGUAGE,
+		XKL_CONFIG_REGISTRY_STAT_FOREACH_COUNTRY_VARIANT,
+		XKL_CONFIG_REGISTRY_STAT_FOREACH_LANGUAGE_VARIANT,
+		XKL_CONFIG_REGISTRY_STAT_FOREACH_FILTERED,
+		XKL_CONFIG_REGISTRY_STAT_FIND_MODEL,
+		XKL_CONFIG_REGISTRY_STAT_FIND_LAYOUT,
+		XKL_CONFIG_REGISTRY_STAT_FIND_VARIANT,
+		XKL_CONFIG_REGISTRY_STAT_FIND_OPTION_GROUP,
+		XKL_CONFIG_REGISTRY_STAT_FIND_OPTION,
+		XKL_CONFIG_REGISTRY_STAT_SEARCH_BY_PATTERN,
+		XKL_CONFIG_REGISTRY_STAT_SEARCH_FUZZY,
+		XKL_CONFIG_REGISTRY_NUM_STATS
+	} XklConfigRegistryStat;
+
+/**
+ * xkl_config_registry_get_stat:
+ * @config: the config registry
+ * @stat: the operation
+ * @count: (out) (allow-none): how many times it was done
+ * @usec: (out) (allow-none): how long it took, in microseconds
+ *
+ * Reports how often the operation was done since the registry was
+ * created (or the counters were reset) and the total time spent.
+ * The time of the enumerations includes the callbacks.
+ * The operations nest: loading includes parsing and indexing,
+ * indexing includes reading and translating the items.
+ * Returns: TRUE on success, FALSE if @stat is out of range
+ */
+	extern gboolean xkl_config_registry_get_stat(XklConfigRegistry *
+						     config,
+						     XklConfigRegistryStat
+						     stat, guint * count,
+						     gint64 * usec);
+
+/**
+ * xkl_config_registry_reset_stats:
+ * @config: the config registry
+ *
+ * Resets all the counters and timers to zero
+ */
+	extern void xkl_config_registry_reset_stats(XklConfigRegistry *
+						    config);
+
 #ifdef __cplusplus
 }
 #endif				/* __cplusplus */
@@ -311,6 +311,19 @@ extern "C" {
 	extern gint xkl_engine_filter_events(XklEngine * engine,
 					     XEvent * evt);
 
+/**
+ * xkl_engine_get_num_suppressed_resets:
+ * @engine: the engine
+ *
+ * The configuration changes come as bursts of events, which are
+ * processed with a single reload of the keyboard info once the event
+ * queue is drained. Meant for monitoring.
+ *
+ * Returns: the number of the reloads saved that way
+ */
+	extern guint xkl_engine_get_num_suppressed_resets(XklEngine *
+							  engine);
+
 /**
  * xkl_engine_allow_one_switch_to_secondary_group:
  * @engine: the engine
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2002-2006 Sergey V. Udaltsov <svu@gnome.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Writes the registry snapshots xkl_config_registry_load() takes
+ * instead of the XML files. Meant to be run at install time, and every
+ * time xkeyboard-config or iso-codes change.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <libxklavier/xklavier.h>
+
+#ifdef HAVE_SETLOCALE
+# include <locale.h>
+#endif
+
+static void
+print_usage(void)
+{
+	printf
+	    ("Usage: xkl-registry-compile [-b <baseDir>] [-r <ruleset>] [-o <snapshotDir>] [-d <debugLevel>] [<locale> ...]\n");
+	printf("Options:\n");
+	printf("         -b - The directory of the registry files (by default, "
+	       XKB_BASE "/rules)\n");
+	printf("         -r - The ruleset (by default, "
+	       XKB_DEFAULT_RULESET ")\n");
+	printf("         -o - Where to write the snapshots (by default, "
+	       XKL_SNAPSHOT_DIR ")\n");
+	printf("         -d - Set the debug level (by default, 0)\n");
+	printf("         -h - Show this help\n");
+	printf
+	    ("The snapshots are made for every locale given, for the current one if none is.\n");
+}
+
+static gboolean
+compile(const gchar * base_dir, const gchar * ruleset,
+	gboolean if_extras_needed, const gchar * snapshot_dir)
+{
+	if (xkl_config_registry_compile_snapshot
+	    (base_dir, ruleset, if_extras_needed, snapshot_dir))
+		return TRUE;
+
+	fprintf(stderr, "Could not compile %s%s for %s: %s\n", ruleset,
+		if_extras_needed ? " with extras" : "",
+		g_get_language_names()[0], xkl_get_last_error());
+	return FALSE;
+}
+
+/* Without and with the extras, xkl_config_registry_load() may need both */
+static gboolean
+compile_for_current_locale(const gchar * base_dir, const gchar * ruleset,
+			   const gchar * snapshot_dir)
+{
+	return compile(base_dir, ruleset, FALSE, snapshot_dir)
+	    && compile(base_dir, ruleset, TRUE, snapshot_dir);
+}
+
+int
+main(int argc, char *const argv[])
+{
+	int c, i;
+	const gchar *base_dir = XKB_BASE "/rules";
+	const gchar *ruleset = XKB_DEFAULT_RULESET;
+	const gchar *snapshot_dir = XKL_SNAPSHOT_DIR;
+	int debug_level = -1;
+	int rv = 0;
+
+	while (1) {
+		c = getopt(argc, argv, "hb:r:o:d:");
+		if (c == -1)
+			break;
+		switch (c) {
+		case 'b':
+			base_dir = optarg;
+			break;
+		case 'r':
+			ruleset = optarg;
+			break;
+		case 'o':
+			snapshot_dir = optarg;
+			break;
+		case 'd':
+			debug_level = atoi(optarg);
+			break;
+		case 'h':
+			print_usage();
+			exit(0);
+		default:
+			print_usage();
+			exit(1);
+		}
+	}
+
+	if (debug_level != -1)
+		xkl_set_debug_level(debug_level);
+
+	if (g_mkdir_with_parents(snapshot_dir, 0755) != 0) {
+		fprintf(stderr, "Could not create %s\n", snapshot_dir);
+		exit(1);
+	}
+
+	if (optind == argc) {
+#ifdef HAVE_SETLOCALE
+		setlocale(LC_ALL, "");
+#endif
+		exit(compile_for_current_locale
+		     (base_dir, ruleset, snapshot_dir) ? 0 : 1);
+	}
+
+	/* the translations are taken for the locale, like at runtime */
+	g_unsetenv("LANGUAGE");
+	for (i = optind; i < argc; i++) {
+		g_setenv("LC_ALL", argv[i], TRUE);
+#ifdef HAVE_SETLOCALE
+		if (setlocale(LC_ALL, "") == NULL) {
+			fprintf(stderr, "Locale %s is not available\n",
+				argv[i]);
+			rv = 1;
+			continue;
+		}
+#endif
+		if (!compile_for_current_locale
+		    (base_dir, ruleset, snapshot_dir))
+			rv = 1;
+	}
+	return rv;
+}
@@ -531,19 +531,42 @@ xkl_engine_get_backend_name(XklEngine * engine)
 guint
 xkl_engine_get_features(XklEngine * engine)
 {
+	if (!xkl_engine_priv(engine, features_probed)) {
+		xkl_engine_priv(engine, features_probed) = TRUE;
+		if (xkl_engine_priv(engine, probe_features) != NULL)
+			xkl_engine_vcall(engine, probe_features) (engine);
+	}
 	return xkl_engine_priv(engine, features);
 }
 
+static void
+xkl_engine_cancel_idle_reset(XklEngine * engine)
+{
+	if (xkl_engine_priv(engine, reset_idle_id) != 0) {
+		g_source_remove(xkl_engine_priv(engine, reset_idle_id));
+		xkl_engine_priv(engine, reset_idle_id) = 0;
+	}
+}
+
 void
 xkl_engine_reset_all_info(XklEngine * engine, gboolean force,
 			  const gchar reason[])
 {
 	xkl_debug(150, "Resetting all the cached info, reason: [%s]\n",
 		  reason);
+	/* covers the postponed one as well */
+	if (xkl_engine_priv(engine, reset_pending)) {
+		force |= xkl_engine_priv(engine, reset_pending_force);
+		xkl_engine_priv(engine, reset_pending) = FALSE;
+		xkl_engine_priv(engine, reset_pending_force) = FALSE;
+		xkl_engine_priv(engine, suppressed_resets)++;
+		xkl_engine_cancel_idle_reset(engine);
+	}
 	xkl_engine_ensure_vtable_inited(engine);
 	if (force
 	    || !xkl_engine_vcall(engine, if_cached_info_equals_actual)
 	    (engine)) {
+		xkl_engine_priv(engine, config_generation)++;
 		xkl_engine_vcall(engine, free_all_info) (engine);
 		xkl_engine_vcall(engine, load_all_info) (engine);
 	} else
@@ -551,6 +574,72 @@ xkl_engine_reset_all_info(XklEngine * engine, gboolean force,
 			  "NOT Resetting the cache: same configuration\n");
 }
 
+static gboolean
+xkl_engine_reset_all_info_on_idle(gpointer data)
+{
+	XklEngine *engine = XKL_ENGINE(data);
+
+	xkl_engine_priv(engine, reset_idle_id) = 0;
+	xkl_engine_flush_pending_reset(engine);
+	return FALSE;
+}
+
+/*
+ * A configuration change comes as a burst of events, the info is reset
+ * once, after the last of them
+ */
+void
+xkl_engine_reset_all_info_deferred(XklEngine * engine, gboolean force,
+				   const gchar reason[])
+{
+	xkl_debug(150,
+		  "Postponing the reset of the cached info, reason: [%s]\n",
+		  reason);
+	if (xkl_engine_priv(engine, reset_pending))
+		xkl_engine_priv(engine, suppressed_resets)++;
+	xkl_engine_priv(engine, reset_pending) = TRUE;
+	xkl_engine_priv(engine, reset_pending_force) |= force;
+	/* in case the application stops passing the events to the filter */
+	if (xkl_engine_priv(engine, reset_idle_id) == 0)
+		xkl_engine_priv(engine, reset_idle_id) =
+		    g_idle_add(xkl_engine_reset_all_info_on_idle, engine);
+}
+
+/*
+ * Applies the postponed reset right away, so that the cached info
+ * is not stale while it is being read
+ */
+void
+xkl_engine_flush_pending_reset(XklEngine * engine)
+{
+	gboolean force;
+
+	if (!xkl_engine_priv(engine, reset_pending))
+		return;
+
+	force = xkl_engine_priv(engine, reset_pending_force);
+	xkl_engine_priv(engine, reset_pending) = FALSE;
+	xkl_engine_priv(engine, reset_pending_force) = FALSE;
+	xkl_engine_cancel_idle_reset(engine);
+	xkl_engine_reset_all_info(engine, force,
+				  "The configuration events are over");
+}
+
+void
+xkl_engine_reset_all_info_if_idle(XklEngine * engine)
+{
+	if (xkl_engine_priv(engine, reset_pending)
+	    && XEventsQueued(xkl_engine_get_display(engine),
+			     QueuedAlready) == 0)
+		xkl_engine_flush_pending_reset(engine);
+}
+
+guint
+xkl_engine_get_num_suppressed_resets(XklEngine * engine)
+{
+	return xkl_engine_priv(engine, suppressed_resets);
+}
+
 /*
  * Calling through vtable
  */
@@ -558,6 +647,7 @@ const gchar **
 xkl_engine_get_groups_names(XklEngine * engine)
 {
 	xkl_engine_ensure_vtable_inited(engine);
+	xkl_engine_flush_pending_reset(engine);
 	return xkl_engine_vcall(engine, get_groups_names) (engine);
 }
 
@@ -565,6 +655,7 @@ const gchar **
 xkl_engine_get_indicators_names(XklEngine * engine)
 {
 	xkl_engine_ensure_vtable_inited(engine);
+	xkl_engine_flush_pending_reset(engine);
 	return xkl_engine_vcall(engine, get_indicators_names) (engine);
 }
 
@@ -572,6 +663,7 @@ guint
 xkl_engine_get_num_groups(XklEngine * engine)
 {
 	xkl_engine_ensure_vtable_inited(engine);
+	xkl_engine_flush_pending_reset(engine);
 	return xkl_engine_vcall(engine, get_num_groups) (engine);
 }
 
@@ -748,8 +840,7 @@ xkl_engine_get_property(GObject * object,
 				   xkl_engine_priv(engine, backend_id));
 		break;
 	case PROP_FEATURES:
-		g_value_set_flags(value,
-				  xkl_engine_priv(engine, features));
+		g_value_set_flags(value, xkl_engine_get_features(engine));
 		break;
 	case PROP_MAX_NUM_GROUPS:
 		g_value_set_uint(value,
@@ -788,6 +879,8 @@ xkl_engine_finalize(GObject * obj)
 	XSetErrorHandler((XErrorHandler)
 			 xkl_engine_priv(engine, default_error_handler));
 
+	xkl_engine_cancel_idle_reset(engine);
+
 	xkl_engine_ensure_vtable_inited(engine);
 	xkl_engine_vcall(engine, free_all_info) (engine);
 
@@ -31,32 +31,16 @@
 
 static GObjectClass *parent_class = NULL;
 
-static xmlXPathCompExprPtr models_xpath;
-static xmlXPathCompExprPtr layouts_xpath;
-static xmlXPathCompExprPtr option_groups_xpath;
-
 static GRegex **xml_encode_regexen = NULL;
 static GRegex **xml_decode_regexen = NULL;
 static const char *xml_decode_regexen_str[] = { "&lt;", "&gt;", "&amp;" };
 static const char *xml_encode_regexen_str[] = { "<", ">", "&" };
 
-/* gettext domain for translations */
-#define XKB_DOMAIN "xkeyboard-config"
-
 enum {
 	PROP_0,
 	PROP_ENGINE
 };
 
-typedef struct {
-	gchar **patterns;
-	XklTwoConfigItemsProcessFunc func;
-	gpointer data;
-	gboolean country_matched;
-	gboolean language_matched;
-	const XklConfigItem *layout_item;
-} SearchParamType;
-
 static gboolean
 xkl_xml_find_config_item_child(xmlNodePtr iptr, xmlNodePtr * ptr)
 {
@@ -163,6 +147,7 @@ xkl_read_config_item(XklConfigRegistry * config, gint doc_index,
 	    NULL, *unescaped = NULL;
 
 	gint i;
+	gint64 start = g_get_monotonic_time(), translate_start;
 
 	*item->name = 0;
 	*item->short_description = 0;
@@ -172,8 +157,12 @@ xkl_read_config_item(XklConfigRegistry * config, gint doc_index,
 	g_object_set_data(G_OBJECT(item), XCI_PROP_COUNTRY_LIST, NULL);
 	g_object_set_data(G_OBJECT(item), XCI_PROP_LANGUAGE_LIST, NULL);
 
-	if (!xkl_xml_find_config_item_child(iptr, &ptr))
+	if (!xkl_xml_find_config_item_child(iptr, &ptr)) {
+		xkl_config_registry_stat_add(config,
+					     XKL_CONFIG_REGISTRY_STAT_READ_ITEM,
+					     start);
 		return FALSE;
+	}
 
 	if (doc_index > 0)
 		g_object_set_data(G_OBJECT(item), XCI_PROP_EXTRA_ITEM,
@@ -195,6 +184,8 @@ xkl_read_config_item(XklConfigRegistry * config, gint doc_index,
 			(char *) name_element->children->content,
 			XKL_MAX_CI_NAME_LENGTH - 1);
 
+	translate_start = g_get_monotonic_time();
+
 	if (short_desc_element != NULL
 	    && short_desc_element->children != NULL) {
 		strncat(item->short_description,
@@ -243,6 +234,10 @@ xkl_read_config_item(XklConfigRegistry * config, gint doc_index,
 		g_free(translated);
 	}
 
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_TRANSLATE,
+				     translate_start);
+
 	if (vendor_element != NULL && vendor_element->children != NULL) {
 		vendor =
 		    g_strdup((const char *) vendor_element->children->
@@ -258,164 +253,12 @@ xkl_read_config_item(XklConfigRegistry * config, gint doc_index,
 					 XML_TAG_ISO639ID,
 					 XCI_PROP_LANGUAGE_LIST);
 
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_READ_ITEM,
+				     start);
 	return TRUE;
 }
 
-static void
-xkl_config_registry_foreach_in_nodeset(XklConfigRegistry * config,
-				       GSList ** processed_ids,
-				       gint doc_index, xmlNodeSetPtr nodes,
-				       XklConfigItemProcessFunc func,
-				       gpointer data)
-{
-	gint i;
-	if (nodes != NULL) {
-		xmlNodePtr *pnode = nodes->nodeTab;
-		XklConfigItem *ci = xkl_config_item_new();
-		for (i = nodes->nodeNr; --i >= 0;) {
-			if (xkl_read_config_item
-			    (config, doc_index, *pnode, ci)) {
-				if (g_slist_find_custom
-				    (*processed_ids, ci->name,
-				     (GCompareFunc) g_ascii_strcasecmp) ==
-				    NULL) {
-					func(config, ci, data);
-					*processed_ids =
-					    g_slist_append(*processed_ids,
-							   g_strdup
-							   (ci->name));
-				}
-			}
-
-			pnode++;
-		}
-		g_object_unref(G_OBJECT(ci));
-	}
-}
-
-void
-xkl_config_registry_foreach_in_xpath(XklConfigRegistry * config,
-				     xmlXPathCompExprPtr
-				     xpath_comp_expr,
-				     XklConfigItemProcessFunc func,
-				     gpointer data)
-{
-	xmlXPathObjectPtr xpath_obj;
-	gint di;
-	GSList *processed_ids = NULL;
-
-	if (!xkl_config_registry_is_initialized(config))
-		return;
-
-	for (di = 0; di < XKL_NUMBER_OF_REGISTRY_DOCS; di++) {
-		xmlXPathContextPtr xmlctxt =
-		    xkl_config_registry_priv(config, xpath_contexts[di]);
-		if (xmlctxt == NULL)
-			continue;
-
-		xpath_obj = xmlXPathCompiledEval(xpath_comp_expr, xmlctxt);
-		if (xpath_obj == NULL)
-			continue;
-
-		xkl_config_registry_foreach_in_nodeset(config,
-						       &processed_ids, di,
-						       xpath_obj->
-						       nodesetval, func,
-						       data);
-		xmlXPathFreeObject(xpath_obj);
-	}
-	g_slist_foreach(processed_ids, (GFunc) g_free, NULL);
-	g_slist_free(processed_ids);
-}
-
-void
-xkl_config_registry_foreach_in_xpath_with_param(XklConfigRegistry
-						* config,
-						const gchar *
-						format,
-						const gchar *
-						value,
-						XklConfigItemProcessFunc
-						func, gpointer data)
-{
-	char xpath_expr[1024];
-	xmlXPathObjectPtr xpath_obj;
-	gint di;
-	GSList *processed_ids = NULL;
-
-	if (!xkl_config_registry_is_initialized(config))
-		return;
-
-	g_snprintf(xpath_expr, sizeof xpath_expr, format, value);
-
-	for (di = 0; di < XKL_NUMBER_OF_REGISTRY_DOCS; di++) {
-		xmlXPathContextPtr xmlctxt =
-		    xkl_config_registry_priv(config, xpath_contexts[di]);
-		if (xmlctxt == NULL)
-			continue;
-
-		xpath_obj =
-		    xmlXPathEval((unsigned char *) xpath_expr, xmlctxt);
-		if (xpath_obj == NULL)
-			continue;
-
-		xkl_config_registry_foreach_in_nodeset(config,
-						       &processed_ids, di,
-						       xpath_obj->
-						       nodesetval, func,
-						       data);
-		xmlXPathFreeObject(xpath_obj);
-	}
-	g_slist_foreach(processed_ids, (GFunc) g_free, NULL);
-	g_slist_free(processed_ids);
-}
-
-static gboolean
-xkl_config_registry_find_object(XklConfigRegistry * config,
-				const gchar * format,
-				const gchar * arg1,
-				XklConfigItem * pitem /* in/out */ ,
-				xmlNodePtr * pnode /* out */ )
-{
-	xmlXPathObjectPtr xpath_obj;
-	xmlNodeSetPtr nodes;
-	gboolean rv = FALSE;
-	gchar xpath_expr[1024];
-	gint di;
-
-	if (!xkl_config_registry_is_initialized(config))
-		return FALSE;
-
-	g_snprintf(xpath_expr, sizeof xpath_expr, format, arg1,
-		   pitem->name);
-
-	for (di = 0; di < XKL_NUMBER_OF_REGISTRY_DOCS; di++) {
-		xmlXPathContextPtr xmlctxt =
-		    xkl_config_registry_priv(config, xpath_contexts[di]);
-		if (xmlctxt == NULL)
-			continue;
-
-		xpath_obj =
-		    xmlXPathEval((unsigned char *) xpath_expr, xmlctxt);
-		if (xpath_obj == NULL)
-			continue;
-
-		nodes = xpath_obj->nodesetval;
-		if (nodes != NULL && nodes->nodeTab != NULL
-		    && nodes->nodeNr > 0) {
-			rv = xkl_read_config_item(config, di,
-						  nodes->nodeTab[0],
-						  pitem);
-			if (pnode != NULL) {
-				*pnode = *nodes->nodeTab;
-			}
-		}
-
-		xmlXPathFreeObject(xpath_obj);
-	}
-	return rv;
-}
-
 gchar *
 xkl_config_rec_merge_layouts(const XklConfigRec * data)
 {
@@ -513,33 +356,47 @@ xkl_config_registry_get_instance(XklEngine * engine)
 	return config;
 }
 
-/* We process descriptions as "leaf" elements - this is ok for base.xml*/
-gboolean
-xkl_config_registry_load_from_file(XklConfigRegistry * config,
-				   const gchar * file_name, gint docidx)
-{
-	xmlParserCtxtPtr ctxt = xmlNewParserCtxt();
-	xmlDocPtr doc;
+/* Registry files may also be shipped compressed */
+static const gchar *registry_file_suffixes[] = { "", ".gz", ".zst", NULL };
 
-	xkl_debug(100, "Loading XML registry from file %s\n", file_name);
-
-	xmlSAX2InitDefaultSAXHandler(ctxt->sax, TRUE);
+static gboolean
+xkl_config_registry_find_file(gchar * file_name, gsize size,
+			      const char base_dir[], const gchar * rf,
+			      const gchar * kind)
+{
+	struct stat stat_buf;
+	const gchar **suffix;
 
-	doc = xkl_config_registry_priv(config, docs[docidx]) =
-	    xmlCtxtReadFile(ctxt, file_name, NULL, XML_PARSE_NOBLANKS);
-	xmlFreeParserCtxt(ctxt);
+	for (suffix = registry_file_suffixes; *suffix != NULL; suffix++) {
+		g_snprintf(file_name, size, "%s/%s%s.xml%s", base_dir, rf,
+			   kind, *suffix);
+		if (stat(file_name, &stat_buf) == 0)
+			return TRUE;
+	}
+	g_snprintf(file_name, size, "%s/%s%s.xml", base_dir, rf, kind);
+	return FALSE;
+}
 
-	if (doc == NULL) {
-		xkl_config_registry_priv(config, xpath_contexts[docidx]) =
-		    NULL;
-		xkl_last_error_message =
-		    "Could not parse primary XKB configuration registry";
+/*
+ * Finds the registry files of the ruleset, the extras one is
+ * left empty if not needed or not there (no extras - ok, no problem)
+ */
+static gboolean
+xkl_config_registry_find_files(gchar * file_name,
+			       gchar * extras_file_name, gsize size,
+			       const char base_dir[], const gchar * rf,
+			       gboolean if_extras_needed)
+{
+	if (!xkl_config_registry_find_file
+	    (file_name, size, base_dir, rf, "")) {
+		xkl_debug(0, "Missing registry file %s\n", file_name);
+		xkl_last_error_message = "Missing registry file";
 		return FALSE;
 	}
 
-	xkl_config_registry_priv(config, xpath_contexts[docidx]) =
-	    xmlXPathNewContext(doc);
-
+	if (!if_extras_needed || !xkl_config_registry_find_file
+	    (extras_file_name, size, base_dir, rf, ".extras"))
+		*extras_file_name = '\0';
 	return TRUE;
 }
 
@@ -549,43 +406,101 @@ xkl_config_registry_load_helper(XklConfigRegistry * config,
 				const char base_dir[],
 				gboolean if_extras_needed)
 {
-	struct stat stat_buf;
 	gchar file_name[MAXPATHLEN] = "";
+	gchar extras_file_name[MAXPATHLEN] = "";
+	const gchar *doc_files[XKL_NUMBER_OF_REGISTRY_DOCS];
 	XklEngine *engine = xkl_config_registry_get_engine(config);
 	gchar *rf = xkl_engine_get_ruleset_name(engine, default_ruleset);
+	gchar *snapshot_name;
+	gboolean rv;
 
 	if (rf == NULL || rf[0] == '\0')
 		return FALSE;
 
-	g_snprintf(file_name, sizeof file_name, "%s/%s.xml", base_dir, rf);
-
-	if (stat(file_name, &stat_buf) != 0) {
-		xkl_debug(0, "Missing registry file %s\n", file_name);
-		xkl_last_error_message = "Missing registry file";
+	if (!xkl_config_registry_find_files
+	    (file_name, extras_file_name, sizeof file_name, base_dir, rf,
+	     if_extras_needed))
 		return FALSE;
+
+	/* the precompiled snapshot is good as long as the files are */
+	doc_files[0] = file_name;
+	doc_files[1] = *extras_file_name ? extras_file_name : NULL;
+	snapshot_name =
+	    xkl_config_registry_get_snapshot_name(XKL_SNAPSHOT_DIR, rf,
+						  if_extras_needed);
+	if (snapshot_name != NULL) {
+		rv = xkl_config_registry_load_snapshot_for(config,
+							   snapshot_name,
+							   doc_files);
+		g_free(snapshot_name);
+		if (rv)
+			return TRUE;
 	}
 
 	if (!xkl_config_registry_load_from_file(config, file_name, 0))
 		return FALSE;
 
-	if (!if_extras_needed)
+	if (!*extras_file_name)
 		return TRUE;
 
-	g_snprintf(file_name, sizeof file_name, "%s/%s.extras.xml",
-		   base_dir, rf);
+	return xkl_config_registry_load_from_file(config, extras_file_name,
+						  1);
+}
 
-	/* no extras - ok, no problem */
-	if (stat(file_name, &stat_buf) != 0)
-		return TRUE;
+gboolean
+xkl_config_registry_compile_snapshot(const gchar * base_dir,
+				     const gchar * ruleset,
+				     gboolean if_extras_needed,
+				     const gchar * snapshot_dir)
+{
+	gchar file_name[MAXPATHLEN] = "";
+	gchar extras_file_name[MAXPATHLEN] = "";
+	XklConfigRegistry *config;
+	gchar *snapshot_name;
+	gboolean rv;
+
+	if (!xkl_config_registry_find_files
+	    (file_name, extras_file_name, sizeof file_name, base_dir,
+	     ruleset, if_extras_needed))
+		return FALSE;
+
+	/* no engine: nothing but the files is needed */
+	config =
+	    XKL_CONFIG_REGISTRY(g_object_new
+				(xkl_config_registry_get_type(), NULL));
 
-	return xkl_config_registry_load_from_file(config, file_name, 1);
+	rv = xkl_config_registry_load_from_path(config, file_name,
+						*extras_file_name ?
+						extras_file_name : NULL);
+	if (rv) {
+		snapshot_name =
+		    xkl_config_registry_get_snapshot_name(snapshot_dir,
+							  ruleset,
+							  if_extras_needed);
+		if (snapshot_name != NULL) {
+			rv = xkl_config_registry_save_snapshot(config,
+							       snapshot_name);
+			g_free(snapshot_name);
+		} else {
+			xkl_last_error_message =
+			    "The translations are not for a single locale";
+			rv = FALSE;
+		}
+	}
+
+	g_object_unref(G_OBJECT(config));
+	return rv;
 }
 
 void
 xkl_config_registry_free(XklConfigRegistry * config)
 {
+	gint di;
+
+	xkl_config_index_free(xkl_config_registry_priv(config, index));
+	xkl_config_registry_priv(config, index) = NULL;
+
 	if (xkl_config_registry_is_initialized(config)) {
-		gint di;
 		for (di = 0; di < XKL_NUMBER_OF_REGISTRY_DOCS; di++) {
 			xmlXPathContextPtr xmlctxt =
 			    xkl_config_registry_priv(config,
@@ -603,6 +518,74 @@ xkl_config_registry_free(XklConfigRegistry * config)
 		}
 
 	}
+
+	for (di = 0; di < XKL_NUMBER_OF_REGISTRY_DOCS; di++) {
+		g_free(xkl_config_registry_priv(config, doc_files[di]));
+		xkl_config_registry_priv(config, doc_files[di]) = NULL;
+	}
+}
+
+static void
+xkl_config_registry_foreach_in_table(XklConfigRegistry * config,
+				     GArray * table,
+				     XklConfigIndexFillFunc fill,
+				     XklConfigItemProcessFunc func,
+				     gpointer data)
+{
+	XklConfigItem *ci = xkl_config_item_new();
+	guint i;
+
+	for (i = 0; i < table->len; i++) {
+		fill(&g_array_index(table, XklConfigIndexItem, i), ci);
+		func(config, ci, data);
+	}
+	g_object_unref(G_OBJECT(ci));
+}
+
+/* The variants of the layout, the options of the group */
+static void
+xkl_config_registry_foreach_child(XklConfigRegistry * config,
+				  GArray * parents, GArray * children,
+				  gint parent,
+				  XklConfigItemProcessFunc func,
+				  gpointer data)
+{
+	XklConfigItem *ci;
+	gint i;
+
+	if (parent < 0)
+		return;
+
+	ci = xkl_config_item_new();
+	for (i = g_array_index(parents, XklConfigIndexItem,
+			       parent).first_child; i >= 0;
+	     i = g_array_index(children, XklConfigIndexItem,
+			       i).next_sibling) {
+		xkl_config_index_item_fill(&g_array_index
+					   (children, XklConfigIndexItem,
+					    i), ci);
+		func(config, ci, data);
+	}
+	g_object_unref(G_OBJECT(ci));
+}
+
+static gint
+xkl_config_registry_find_child(GArray * parents, GArray * children,
+			       gint parent, const gchar * name)
+{
+	gint i;
+
+	if (parent < 0)
+		return -1;
+
+	for (i = g_array_index(parents, XklConfigIndexItem,
+			       parent).first_child; i >= 0;
+	     i = g_array_index(children, XklConfigIndexItem,
+			       i).next_sibling)
+		if (!strcmp(g_array_index(children, XklConfigIndexItem,
+					  i).name, name))
+			return i;
+	return -1;
 }
 
 void
@@ -610,8 +593,17 @@ xkl_config_registry_foreach_model(XklConfigRegistry * config,
 				  XklConfigItemProcessFunc func,
 				  gpointer data)
 {
-	xkl_config_registry_foreach_in_xpath(config, models_xpath,
-					     func, data);
+	XklConfigIndex *index = xkl_config_registry_priv(config, index);
+	gint64 start = g_get_monotonic_time();
+
+	if (index != NULL)
+		xkl_config_registry_foreach_in_table(config, index->models,
+						     xkl_config_index_item_fill,
+						     func, data);
+
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_FOREACH_MODEL,
+				     start);
 }
 
 void
@@ -619,8 +611,18 @@ xkl_config_registry_foreach_layout(XklConfigRegistry * config,
 				   XklConfigItemProcessFunc func,
 				   gpointer data)
 {
-	xkl_config_registry_foreach_in_xpath(config, layouts_xpath,
-					     func, data);
+	XklConfigIndex *index = xkl_config_registry_priv(config, index);
+	gint64 start = g_get_monotonic_time();
+
+	if (index != NULL)
+		xkl_config_registry_foreach_in_table(config,
+						     index->layouts,
+						     xkl_config_index_item_fill,
+						     func, data);
+
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_FOREACH_LAYOUT,
+				     start);
 }
 
 void
@@ -631,11 +633,19 @@ xkl_config_registry_foreach_layout_variant(XklConfigRegistry *
 					   XklConfigItemProcessFunc
 					   func, gpointer data)
 {
-	xkl_config_registry_foreach_in_xpath_with_param(config,
-							XKBCR_VARIANT_PATH
-							"[../../configItem/name = '%s']",
-							layout_name,
-							func, data);
+	XklConfigIndex *index = xkl_config_registry_priv(config, index);
+	gint64 start = g_get_monotonic_time();
+
+	if (index != NULL)
+		xkl_config_registry_foreach_child(config, index->layouts,
+						  index->variants,
+						  xkl_config_index_find_layout
+						  (index, layout_name),
+						  func, data);
+
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_FOREACH_LAYOUT_VARIANT,
+				     start);
 }
 
 void
@@ -644,71 +654,18 @@ xkl_config_registry_foreach_option_group(XklConfigRegistry *
 					 XklConfigItemProcessFunc
 					 func, gpointer data)
 {
-	xmlXPathObjectPtr xpath_obj;
-	gint di, j;
-	GSList *processed_ids = NULL;
-
-	if (!xkl_config_registry_is_initialized(config))
-		return;
-
-	for (di = 0; di < XKL_NUMBER_OF_REGISTRY_DOCS; di++) {
-		xmlNodeSetPtr nodes;
-		xmlNodePtr *pnode;
-		XklConfigItem *ci;
-
-		xmlXPathContextPtr xmlctxt =
-		    xkl_config_registry_priv(config, xpath_contexts[di]);
-		if (xmlctxt == NULL)
-			continue;
-
-		xpath_obj =
-		    xmlXPathCompiledEval(option_groups_xpath, xmlctxt);
-		if (xpath_obj == NULL)
-			continue;
-
-		nodes = xpath_obj->nodesetval;
-		pnode = nodes->nodeTab;
-		ci = xkl_config_item_new();
-		for (j = nodes->nodeNr; --j >= 0;) {
-
-			if (xkl_read_config_item(config, di, *pnode, ci)) {
-				if (g_slist_find_custom
-				    (processed_ids, ci->name,
-				     (GCompareFunc) g_ascii_strcasecmp) ==
-				    NULL) {
-					gboolean allow_multisel = TRUE;
-					xmlChar *sallow_multisel =
-					    xmlGetProp(*pnode,
-						       (unsigned char *)
-						       XCI_PROP_ALLOW_MULTIPLE_SELECTION);
-					if (sallow_multisel != NULL) {
-						allow_multisel =
-						    !g_ascii_strcasecmp
-						    ("true", (char *)
-						     sallow_multisel);
-						xmlFree(sallow_multisel);
-						g_object_set_data(G_OBJECT
-								  (ci),
-								  XCI_PROP_ALLOW_MULTIPLE_SELECTION,
-								  GINT_TO_POINTER
-								  (allow_multisel));
-					}
-
-					func(config, ci, data);
-					processed_ids =
-					    g_slist_append(processed_ids,
-							   g_strdup
-							   (ci->name));
-				}
-			}
-
-			pnode++;
-		}
-		g_object_unref(G_OBJECT(ci));
-		xmlXPathFreeObject(xpath_obj);
-	}
-	g_slist_foreach(processed_ids, (GFunc) g_free, NULL);
-	g_slist_free(processed_ids);
+	XklConfigIndex *index = xkl_config_registry_priv(config, index);
+	gint64 start = g_get_monotonic_time();
+
+	if (index != NULL)
+		xkl_config_registry_foreach_in_table(config,
+						     index->option_groups,
+						     xkl_config_index_group_fill,
+						     func, data);
+
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_FOREACH_OPTION_GROUP,
+				     start);
 }
 
 void
@@ -718,296 +675,505 @@ xkl_config_registry_foreach_option(XklConfigRegistry * config,
 				   XklConfigItemProcessFunc func,
 				   gpointer data)
 {
-	xkl_config_registry_foreach_in_xpath_with_param(config,
-							XKBCR_OPTION_PATH
-							"[../configItem/name = '%s']",
-							option_group_name,
-							func, data);
+	XklConfigIndex *index = xkl_config_registry_priv(config, index);
+	gint64 start = g_get_monotonic_time();
+
+	if (index != NULL)
+		xkl_config_registry_foreach_child(config,
+						  index->option_groups,
+						  index->options,
+						  xkl_config_index_find_option_group
+						  (index, option_group_name),
+						  func, data);
+
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_FOREACH_OPTION,
+				     start);
 }
 
-static gboolean
-search_all(const gchar * haystack, gchar ** needles)
+void
+xkl_config_registry_foreach_option_group_with_options(XklConfigRegistry
+						      * config,
+						      XklTwoConfigItemsProcessFunc
+						      func, gpointer data)
 {
-	/* match anything */
-	if (!needles || !*needles)
-		return TRUE;
+	XklConfigIndex *index = xkl_config_registry_priv(config, index);
+	gint64 start = g_get_monotonic_time();
+	XklConfigItem *group_ci, *option_ci;
+	guint g;
+	gint i;
 
-	gchar *uchs = g_utf8_strup(haystack, -1);
-	do {
-		if (g_strstr_len(uchs, -1, *needles) == NULL) {
-			g_free(uchs);
-			return FALSE;
+	if (index != NULL) {
+		group_ci = xkl_config_item_new();
+		option_ci = xkl_config_item_new();
+		for (g = 0; g < index->option_groups->len; g++) {
+			const XklConfigIndexItem *gitem =
+			    xkl_config_index_item(index, option_groups, g);
+
+			xkl_config_index_group_fill(gitem, group_ci);
+			func(config, group_ci, NULL, data);
+
+			for (i = gitem->first_child; i >= 0;
+			     i = xkl_config_index_item(index, options,
+						       i)->next_sibling) {
+				xkl_config_index_item_fill
+				    (xkl_config_index_item
+				     (index, options, i), option_ci);
+				func(config, group_ci, option_ci, data);
+			}
 		}
-		needles++;
-	} while (*needles);
+		g_object_unref(G_OBJECT(option_ci));
+		g_object_unref(G_OBJECT(group_ci));
+	}
 
-	g_free(uchs);
-	return TRUE;
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_FOREACH_OPTION_GROUP_WITH_OPTIONS,
+				     start);
 }
 
-static gboolean
-if_country_matches_pattern(const XklConfigItem * item,
-			   gchar ** patterns, const gboolean check_name)
+gboolean
+xkl_config_registry_find_model(XklConfigRegistry *
+			       config, XklConfigItem * pitem /* in/out */ )
 {
-	const gchar *country_desc;
-	if (check_name) {
-		gchar *upper_name = g_ascii_strup(item->name, -1);
-		country_desc = xkl_get_country_name(upper_name);
-		g_free(upper_name);
-		xkl_debug(200, "Checking layout country: [%s]\n",
-			  country_desc);
-		if ((country_desc != NULL)
-		    && search_all(country_desc, patterns))
-			return TRUE;
-	}
-
-	gchar **countries = g_object_get_data(G_OBJECT(item),
-					      XCI_PROP_COUNTRY_LIST);
-	for (; countries && *countries; countries++) {
-		country_desc = xkl_get_country_name(*countries);
-		xkl_debug(200, "Checking country: [%s][%s]\n",
-			  *countries, country_desc);
-		if ((country_desc != NULL)
-		    && search_all(country_desc, patterns)) {
-			return TRUE;
+	XklConfigIndex *index = xkl_config_registry_priv(config, index);
+	gint64 start = g_get_monotonic_time();
+	gboolean rv = FALSE;
+	guint i;
+
+	for (i = 0; index != NULL && !rv && i < index->models->len; i++) {
+		const XklConfigIndexItem *iitem =
+		    xkl_config_index_item(index, models, i);
+		if (!strcmp(iitem->name, pitem->name)) {
+			xkl_config_index_item_fill(iitem, pitem);
+			rv = TRUE;
 		}
 	}
-	return FALSE;
+
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_FIND_MODEL,
+				     start);
+	return rv;
 }
 
-static gboolean
-if_language_matches_pattern(const XklConfigItem * item,
-			    gchar ** patterns, const gboolean check_name)
+gboolean
+xkl_config_registry_find_layout(XklConfigRegistry *
+				config,
+				XklConfigItem * pitem /* in/out */ )
 {
-	const gchar *language_desc;
-	if (check_name) {
-		language_desc = xkl_get_language_name(item->name);
-		xkl_debug(200, "Checking layout language: [%s]\n",
-			  language_desc);
-		if ((language_desc != NULL)
-		    && search_all(language_desc, patterns))
-			return TRUE;
+	XklConfigIndex *index = xkl_config_registry_priv(config, index);
+	gint64 start = g_get_monotonic_time();
+	gint layout = -1;
+
+	if (index != NULL)
+		layout = xkl_config_index_find_layout(index, pitem->name);
+	if (layout >= 0)
+		xkl_config_index_item_fill(xkl_config_index_item
+					   (index, layouts, layout), pitem);
+
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_FIND_LAYOUT,
+				     start);
+	return layout >= 0;
+}
+
+gboolean
+xkl_config_registry_find_variant(XklConfigRegistry *
+				 config,
+				 const char
+				 *layout_name,
+				 XklConfigItem * pitem /* in/out */ )
+{
+	XklConfigIndex *index = xkl_config_registry_priv(config, index);
+	gint64 start = g_get_monotonic_time();
+	gint variant = -1;
+
+	if (index != NULL)
+		variant =
+		    xkl_config_registry_find_child(index->layouts,
+						   index->variants,
+						   xkl_config_index_find_layout
+						   (index, layout_name),
+						   pitem->name);
+	if (variant >= 0)
+		xkl_config_index_item_fill(xkl_config_index_item
+					   (index, variants, variant),
+					   pitem);
+
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_FIND_VARIANT,
+				     start);
+	return variant >= 0;
+}
+
+gboolean
+xkl_config_registry_find_option_group(XklConfigRegistry * config, XklConfigItem * pitem	/* in/out */
+    )
+{
+	XklConfigIndex *index = xkl_config_registry_priv(config, index);
+	gint64 start = g_get_monotonic_time();
+	gint group = -1;
+
+	if (index != NULL)
+		group =
+		    xkl_config_index_find_option_group(index, pitem->name);
+	if (group >= 0)
+		xkl_config_index_group_fill(xkl_config_index_item
+					    (index, option_groups, group),
+					    pitem);
+
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_FIND_OPTION_GROUP,
+				     start);
+	return group >= 0;
+}
+
+gboolean
+xkl_config_registry_find_option(XklConfigRegistry *
+				config,
+				const char
+				*option_group_name,
+				XklConfigItem * pitem /* in/out */ )
+{
+	XklConfigIndex *index = xkl_config_registry_priv(config, index);
+	gint64 start = g_get_monotonic_time();
+	gint option = -1;
+
+	if (index != NULL)
+		option =
+		    xkl_config_registry_find_child(index->option_groups,
+						   index->options,
+						   xkl_config_index_find_option_group
+						   (index, option_group_name),
+						   pitem->name);
+	if (option >= 0)
+		xkl_config_index_item_fill(xkl_config_index_item
+					   (index, options, option), pitem);
+
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_FIND_OPTION,
+				     start);
+	return option >= 0;
+}
+
+static void
+xkl_config_item_unref_if_any(XklConfigItem * item)
+{
+	if (item != NULL)
+		g_object_unref(G_OBJECT(item));
+}
+
+static void
+xkl_config_registry_free_group_items(XklConfigRegistry * config)
+{
+	if (xkl_config_registry_priv(config, group_layout_items) != NULL) {
+		g_ptr_array_free(xkl_config_registry_priv
+				 (config, group_layout_items), TRUE);
+		xkl_config_registry_priv(config, group_layout_items) = NULL;
 	}
-	gchar **languages = g_object_get_data(G_OBJECT(item),
-					      XCI_PROP_LANGUAGE_LIST);
-	for (; languages && *languages; languages++) {
-		language_desc = xkl_get_language_name(*languages);
-		xkl_debug(200, "Checking language: [%s][%s]\n",
-			  *languages, language_desc);
-		if ((language_desc != NULL)
-		    && search_all(language_desc, patterns)) {
-			return TRUE;
-		}
+	if (xkl_config_registry_priv(config, group_variant_items) != NULL) {
+		g_ptr_array_free(xkl_config_registry_priv
+				 (config, group_variant_items), TRUE);
+		xkl_config_registry_priv(config, group_variant_items) =
+		    NULL;
 	}
-	return FALSE;
 }
 
 static void
-xkl_config_registry_search_by_pattern_in_variant(XklConfigRegistry *
-						 config,
-						 const XklConfigItem *
-						 item,
-						 SearchParamType *
-						 search_param)
+xkl_config_registry_load_group_items(XklConfigRegistry * config)
 {
-	gboolean variant_matched = FALSE;
-	gchar *full_desc = g_strdup_printf("%s - %s",
-					   search_param->
-					   layout_item->description,
-					   item->description);
-
-	xkl_debug(200, "Variant to check: [%s][%s]\n", item->name,
-		  item->description);
-
-	if (search_all(full_desc, search_param->patterns))
-		variant_matched = TRUE;
-
-	g_free(full_desc);
-
-	if (!variant_matched) {
-		gchar **countries = g_object_get_data(G_OBJECT(item),
-						      XCI_PROP_COUNTRY_LIST);
-		if (countries && g_strv_length(countries) > 0) {
-			if (if_country_matches_pattern
-			    (item, search_param->patterns, FALSE))
-				variant_matched = TRUE;
-		} else {
-			if (search_param->country_matched)
-				variant_matched = TRUE;
-		}
+	XklEngine *engine = xkl_config_registry_get_engine(config);
+	XklConfigRec *data;
+	GPtrArray *layout_items, *variant_items;
+	gchar **layout, **variant;
+
+	xkl_config_registry_free_group_items(config);
+
+	if (engine == NULL || !xkl_config_registry_is_initialized(config))
+		return;
+
+	xkl_config_registry_priv(config, group_items_generation) =
+	    xkl_engine_priv(engine, config_generation);
+
+	data = xkl_config_rec_new();
+	if (!xkl_config_rec_get_from_server(data, engine)) {
+		g_object_unref(G_OBJECT(data));
+		return;
 	}
 
-	if (!variant_matched) {
-		gchar **languages = g_object_get_data(G_OBJECT(item),
-						      XCI_PROP_LANGUAGE_LIST);
-		if (languages && g_strv_length(languages) > 0) {
-			if (if_language_matches_pattern
-			    (item, search_param->patterns, FALSE))
-				variant_matched = TRUE;
-		} else {
-			if (search_param->language_matched)
-				variant_matched = TRUE;
+	layout_items = g_ptr_array_new_with_free_func((GDestroyNotify)
+						      xkl_config_item_unref_if_any);
+	variant_items = g_ptr_array_new_with_free_func((GDestroyNotify)
+						       xkl_config_item_unref_if_any);
+
+	variant = data->variants;
+	for (layout = data->layouts; layout != NULL && *layout != NULL;
+	     layout++) {
+		XklConfigItem *layout_item = xkl_config_item_new();
+		XklConfigItem *variant_item = NULL;
+
+		g_strlcpy(layout_item->name, *layout,
+			  sizeof layout_item->name);
+		if (!xkl_config_registry_find_layout(config, layout_item)) {
+			g_object_unref(G_OBJECT(layout_item));
+			layout_item = NULL;
 		}
+
+		if (variant != NULL && *variant != NULL) {
+			if (**variant != '\0' && layout_item != NULL) {
+				variant_item = xkl_config_item_new();
+				g_strlcpy(variant_item->name, *variant,
+					  sizeof variant_item->name);
+				if (!xkl_config_registry_find_variant
+				    (config, *layout, variant_item)) {
+					g_object_unref(G_OBJECT
+						       (variant_item));
+					variant_item = NULL;
+				}
+			}
+			variant++;
+		}
+
+		g_ptr_array_add(layout_items, layout_item);
+		g_ptr_array_add(variant_items, variant_item);
 	}
 
-	if (variant_matched)
-		(search_param->func) (config, search_param->layout_item,
-				      item, search_param->data);
+	xkl_debug(150, "Resolved registry items for %d group(s)\n",
+		  layout_items->len);
+
+	xkl_config_registry_priv(config, group_layout_items) = layout_items;
+	xkl_config_registry_priv(config, group_variant_items) =
+	    variant_items;
+	g_object_unref(G_OBJECT(data));
 }
 
+/* The items are resolved again on demand, the handler order does not matter */
 static void
-xkl_config_registry_search_by_pattern_in_layout(XklConfigRegistry * config,
-						const XklConfigItem * item,
-						SearchParamType *
-						search_param)
+xkl_config_registry_config_changed(XklEngine * engine,
+				   XklConfigRegistry * config)
 {
-	gchar *upper_name = g_ascii_strup(item->name, -1);
-
-	xkl_debug(200, "Layout to check: [%s][%s]\n", item->name,
-		  item->description);
+	xkl_config_registry_free_group_items(config);
+}
 
-	search_param->country_matched =
-	    search_param->language_matched = FALSE;
+gboolean
+xkl_config_registry_get_group_items(XklConfigRegistry * config,
+				    gint group,
+				    const XklConfigItem ** layout_item,
+				    const XklConfigItem ** variant_item)
+{
+	XklEngine *engine = xkl_config_registry_get_engine(config);
+	GPtrArray *layout_items;
+	const XklConfigItem *found_layout = NULL, *found_variant = NULL;
+
+	if (xkl_config_registry_priv(config, group_layout_items) == NULL
+	    || (engine != NULL
+		&& xkl_config_registry_priv(config,
+					    group_items_generation) !=
+		xkl_engine_priv(engine, config_generation)))
+		xkl_config_registry_load_group_items(config);
+
+	layout_items = xkl_config_registry_priv(config, group_layout_items);
+	if (layout_items != NULL && group >= 0
+	    && group < (gint) layout_items->len) {
+		found_layout = g_ptr_array_index(layout_items, group);
+		found_variant =
+		    g_ptr_array_index(xkl_config_registry_priv
+				      (config, group_variant_items),
+				      group);
+	}
 
-	if (if_country_matches_pattern(item, search_param->patterns, TRUE))
-		search_param->country_matched = TRUE;
-	else if (if_language_matches_pattern
-		 (item, search_param->patterns, TRUE))
-		search_param->language_matched = TRUE;
-	else if (search_all(item->description, search_param->patterns))
-		search_param->language_matched = TRUE;
+	if (layout_item != NULL)
+		*layout_item = found_layout;
+	if (variant_item != NULL)
+		*variant_item = found_variant;
+	return found_layout != NULL;
+}
 
-	if (search_param->country_matched
-	    || search_param->language_matched)
-		(search_param->func) (config, item, NULL,
-				      search_param->data);
+/*
+ * Calling through vtable
+ */
+gboolean
+xkl_config_rec_activate(const XklConfigRec * data, XklEngine * engine)
+{
+	xkl_engine_ensure_vtable_inited(engine);
+	xkl_engine_flush_pending_reset(engine);
+	return xkl_engine_vcall(engine,
+				activate_config_rec) (engine, data);
+}
 
-	search_param->layout_item = item;
+void
+xkl_config_rec_activate_async(const XklConfigRec * data,
+			      XklEngine * engine,
+			      GCancellable * cancellable,
+			      GAsyncReadyCallback callback,
+			      gpointer user_data)
+{
+	GTask *task;
 
-	xkl_config_registry_foreach_layout_variant(config, item->name,
-						   (XklConfigItemProcessFunc)
-						   xkl_config_registry_search_by_pattern_in_variant,
-						   search_param);
+	xkl_engine_ensure_vtable_inited(engine);
+	xkl_engine_flush_pending_reset(engine);
+	if (xkl_engine_priv(engine, activate_config_rec_async) != NULL) {
+		xkl_engine_vcall(engine, activate_config_rec_async)
+		    (engine, data, cancellable, callback, user_data);
+		return;
+	}
 
-	g_free(upper_name);
+	/* the backend is fast enough not to bother */
+	task = g_task_new(engine, cancellable, callback, user_data);
+	g_task_set_source_tag(task, xkl_config_rec_activate_async);
+	if (!g_task_return_error_if_cancelled(task))
+		xkl_config_rec_activation_return(task,
+						 xkl_config_rec_activate
+						 (data, engine));
+	g_object_unref(task);
 }
 
+/* The failures go to the caller as errors, with the last error message */
 void
-xkl_config_registry_search_by_pattern(XklConfigRegistry
-				      * config,
-				      const gchar *
-				      pattern,
-				      XklTwoConfigItemsProcessFunc
-				      func, gpointer data)
+xkl_config_rec_activation_return(GTask * task, gboolean rv)
 {
-	xkl_debug(200, "Searching by pattern: [%s]\n", pattern);
-	gchar *upattern = pattern ? g_utf8_strup(pattern, -1) : NULL;
-	gchar **patterns = pattern ? g_strsplit(upattern, " ", -1) : NULL;
-	SearchParamType search_param = {
-		patterns, func, data
-	};
-	xkl_config_registry_foreach_layout(config, (XklConfigItemProcessFunc)
-					   xkl_config_registry_search_by_pattern_in_layout,
-					   &search_param);
-	g_strfreev(patterns);
-	g_free(upattern);
+	if (rv)
+		g_task_return_boolean(task, TRUE);
+	else
+		g_task_return_new_error(task, G_IO_ERROR,
+					G_IO_ERROR_FAILED, "%s",
+					xkl_last_error_message != NULL ?
+					xkl_last_error_message :
+					"Could not activate the configuration");
 }
 
 gboolean
-xkl_config_registry_find_model(XklConfigRegistry *
-			       config, XklConfigItem * pitem /* in/out */ )
+xkl_config_rec_precompile(const XklConfigRec * data, XklEngine * engine)
 {
-	return xkl_config_registry_find_object(config,
-					       XKBCR_MODEL_PATH
-					       "[configItem/name = '%s%s']",
-					       "", pitem, NULL);
+	xkl_engine_ensure_vtable_inited(engine);
+	if (xkl_engine_priv(engine, precompile_config_rec) == NULL) {
+		xkl_last_error_message =
+		    "The backend does not compile keymaps";
+		return FALSE;
+	}
+	return xkl_engine_vcall(engine, precompile_config_rec) (engine,
+								 data);
 }
 
 gboolean
-xkl_config_registry_find_layout(XklConfigRegistry *
-				config,
-				XklConfigItem * pitem /* in/out */ )
+xkl_config_rec_activate_finish(XklEngine * engine, GAsyncResult * result,
+			       GError ** error)
 {
-	return xkl_config_registry_find_object(config,
-					       XKBCR_LAYOUT_PATH
-					       "[configItem/name = '%s%s']",
-					       "", pitem, NULL);
+	g_return_val_if_fail(g_task_is_valid(result, engine), FALSE);
+
+	return g_task_propagate_boolean(G_TASK(result), error);
 }
 
 gboolean
-xkl_config_registry_find_variant(XklConfigRegistry *
-				 config,
-				 const char
-				 *layout_name,
-				 XklConfigItem * pitem /* in/out */ )
+xkl_config_registry_load(XklConfigRegistry * config,
+			 gboolean if_extras_needed)
 {
-	return xkl_config_registry_find_object(config,
-					       XKBCR_VARIANT_PATH
-					       "[../../configItem/name = '%s' and configItem/name = '%s']",
-					       layout_name, pitem, NULL);
+	XklEngine *engine;
+	gboolean rv;
+	xkl_config_registry_free(config);
+	xkl_config_registry_free_group_items(config);
+	engine = xkl_config_registry_get_engine(config);
+	if (engine == NULL) {
+		xkl_last_error_message = "No engine to load the registry for";
+		return FALSE;
+	}
+	xkl_engine_ensure_vtable_inited(engine);
+	rv = xkl_engine_vcall(engine, load_config_registry) (config,
+							     if_extras_needed);
+
+	/*
+	 * The main document may be there even if the extras failed.
+	 * Nothing to build if the snapshot was taken.
+	 */
+	if (xkl_config_registry_priv(config, index) == NULL)
+		xkl_config_registry_priv(config, index) =
+		    xkl_config_index_new(config);
+	return rv;
+}
+
+/* The documents are loaded, or the loading failed half way */
+static gboolean
+xkl_config_registry_load_finish(XklConfigRegistry * config, gboolean ok)
+{
+	if (!ok) {
+		xkl_config_registry_free(config);
+		return FALSE;
+	}
+
+	xkl_config_registry_priv(config, index) =
+	    xkl_config_index_new(config);
+	return TRUE;
 }
 
 gboolean
-xkl_config_registry_find_option_group(XklConfigRegistry * config, XklConfigItem * pitem	/* in/out */
-    )
+xkl_config_registry_load_from_bytes(XklConfigRegistry * config,
+				    GBytes * registry, GBytes * extras)
 {
-	xmlNodePtr node = NULL;
-	gboolean rv = xkl_config_registry_find_object(config,
-						      XKBCR_GROUP_PATH
-						      "[configItem/name = '%s%s']",
-						      "", pitem, &node);
-	if (rv) {
-		xmlChar *val = xmlGetProp(node, (unsigned char *)
-					  XCI_PROP_ALLOW_MULTIPLE_SELECTION);
-		if (val != NULL) {
-			gboolean allow_multisel =
-			    !g_ascii_strcasecmp("true",
-						(char *) val);
-			g_object_set_data(G_OBJECT(pitem),
-					  XCI_PROP_ALLOW_MULTIPLE_SELECTION,
-					  GINT_TO_POINTER(allow_multisel));
-			xmlFree(val);
-		}
+	gconstpointer data;
+	gsize size;
+	gboolean ok;
+
+	xkl_config_registry_free(config);
+	xkl_config_registry_free_group_items(config);
+
+	data = g_bytes_get_data(registry, &size);
+	ok = xkl_config_registry_load_from_memory(config, data, size, 0);
+
+	if (ok && extras != NULL) {
+		data = g_bytes_get_data(extras, &size);
+		ok = xkl_config_registry_load_from_memory(config, data,
+							  size, 1);
 	}
-	return rv;
+
+	return xkl_config_registry_load_finish(config, ok);
 }
 
 gboolean
-xkl_config_registry_find_option(XklConfigRegistry *
-				config,
-				const char
-				*option_group_name,
-				XklConfigItem * pitem /* in/out */ )
+xkl_config_registry_load_from_fd(XklConfigRegistry * config,
+				 gint fd, gint extras_fd)
 {
-	return xkl_config_registry_find_object(config,
-					       XKBCR_OPTION_PATH
-					       "[../configItem/name = '%s' and configItem/name = '%s']",
-					       option_group_name,
-					       pitem, NULL);
+	gboolean ok;
+
+	xkl_config_registry_free(config);
+	xkl_config_registry_free_group_items(config);
+
+	ok = xkl_config_registry_load_from_fd_doc(config, fd, 0);
+
+	if (ok && extras_fd != -1)
+		ok = xkl_config_registry_load_from_fd_doc(config,
+							  extras_fd, 1);
+
+	return xkl_config_registry_load_finish(config, ok);
 }
 
-/*
- * Calling through vtable
- */
 gboolean
-xkl_config_rec_activate(const XklConfigRec * data, XklEngine * engine)
+xkl_config_registry_load_from_path(XklConfigRegistry * config,
+				   const gchar * file_name,
+				   const gchar * extras_file_name)
 {
-	xkl_engine_ensure_vtable_inited(engine);
-	return xkl_engine_vcall(engine,
-				activate_config_rec) (engine, data);
+	gboolean ok;
+
+	xkl_config_registry_free(config);
+	xkl_config_registry_free_group_items(config);
+
+	ok = xkl_config_registry_load_from_file(config, file_name, 0);
+
+	if (ok && extras_file_name != NULL)
+		ok = xkl_config_registry_load_from_file(config,
+							extras_file_name,
+							1);
+
+	return xkl_config_registry_load_finish(config, ok);
 }
 
 gboolean
-xkl_config_registry_load(XklConfigRegistry * config,
-			 gboolean if_extras_needed)
+xkl_config_registry_load_snapshot(XklConfigRegistry * config,
+				  const gchar * file_name)
 {
-	XklEngine *engine;
 	xkl_config_registry_free(config);
-	engine = xkl_config_registry_get_engine(config);
-	xkl_engine_ensure_vtable_inited(engine);
-	return xkl_engine_vcall(engine,
-				load_config_registry) (config,
-						       if_extras_needed);
+	xkl_config_registry_free_group_items(config);
+
+	return xkl_config_registry_load_snapshot_for(config, file_name,
+						     NULL);
 }
 
 gboolean
@@ -1031,6 +1197,40 @@ xkl_config_rec_write_to_file(XklEngine * engine,
 	    (engine, file_name, data, binary);
 }
 
+guint
+xkl_config_rec_write_to_files(XklEngine * engine,
+			      XklConfigRecExportJob * jobs, guint n_jobs,
+			      guint max_processes,
+			      XklConfigRecExportFunc func, gpointer data)
+{
+	XklConfigRecExportJob *job;
+	guint i, written = 0;
+
+	for (i = 0; i < n_jobs; i++) {
+		jobs[i].written = FALSE;
+		jobs[i].error = NULL;
+	}
+
+	xkl_engine_ensure_vtable_inited(engine);
+	if (xkl_engine_priv(engine, write_config_rec_to_files) != NULL)
+		return xkl_engine_vcall(engine, write_config_rec_to_files)
+		    (engine, jobs, n_jobs, max_processes, func, data);
+
+	for (i = 0; i < n_jobs; i++) {
+		job = jobs + i;
+		job->written =
+		    xkl_config_rec_write_to_file(engine, job->file_name,
+						 job->data, job->binary);
+		if (job->written)
+			written++;
+		else
+			job->error = xkl_last_error_message;
+		if (func != NULL)
+			func(job, i + 1, n_jobs, data);
+	}
+	return written;
+}
+
 void
 xkl_config_rec_dump(FILE * file, XklConfigRec * data)
 {
@@ -1073,8 +1273,14 @@ xkl_config_registry_constructor(GType type,
 	engine = XKL_ENGINE(g_value_peek_pointer
 			    (construct_properties[0].value));
 	xkl_config_registry_get_engine(config) = engine;
+	/* an engine-less registry only reads the files given to it */
+	if (engine == NULL)
+		return obj;
 	xkl_engine_ensure_vtable_inited(engine);
 	xkl_engine_vcall(engine, init_config_registry) (config);
+	g_signal_connect(engine, "X-config-changed",
+			 G_CALLBACK(xkl_config_registry_config_changed),
+			 config);
 	return obj;
 }
 
@@ -1082,6 +1288,7 @@ static void
 xkl_config_registry_init(XklConfigRegistry * config)
 {
 	config->priv = g_new0(XklConfigRegistryPrivate, 1);
+	config->priv->max_search_threads = 1;
 }
 
 static void
@@ -1107,11 +1314,81 @@ xkl_config_registry_get_property(GObject * object,
 
 }
 
+void
+xkl_config_registry_stat_add(XklConfigRegistry * config,
+			     XklConfigRegistryStat stat, gint64 start)
+{
+	XklConfigRegistryStatCounter *counter =
+	    &xkl_config_registry_priv(config, stats[stat]);
+	counter->count++;
+	counter->usec += g_get_monotonic_time() - start;
+}
+
+gboolean
+xkl_config_registry_get_stat(XklConfigRegistry * config,
+			     XklConfigRegistryStat stat, guint * count,
+			     gint64 * usec)
+{
+	if ((guint) stat >= XKL_CONFIG_REGISTRY_NUM_STATS) {
+		xkl_last_error_message = "No such registry counter";
+		return FALSE;
+	}
+	if (count != NULL)
+		*count = xkl_config_registry_priv(config, stats[stat]).count;
+	if (usec != NULL)
+		*usec = xkl_config_registry_priv(config, stats[stat]).usec;
+	return TRUE;
+}
+
+void
+xkl_config_registry_reset_stats(XklConfigRegistry * config)
+{
+	memset(xkl_config_registry_priv(config, stats), 0,
+	       sizeof(xkl_config_registry_priv(config, stats)));
+}
+
+static void
+xkl_config_registry_dump_stats(XklConfigRegistry * config)
+{
+	static const gchar *names[XKL_CONFIG_REGISTRY_NUM_STATS] = {
+		"load/parse", "load/xpath", "load/index", "load/snapshot",
+		"read item", "translate",
+		"foreach model", "foreach layout", "foreach layout variant",
+		"foreach option group", "foreach option",
+		"foreach option group with options", "foreach country",
+		"foreach language", "foreach country variant",
+		"foreach language variant", "foreach filtered",
+		"find model", "find layout", "find variant",
+		"find option group", "find option",
+		"search by pattern", "search fuzzy"
+	};
+	gint i;
+
+	for (i = 0; i < XKL_CONFIG_REGISTRY_NUM_STATS; i++) {
+		XklConfigRegistryStatCounter *counter =
+		    &xkl_config_registry_priv(config, stats[i]);
+		if (counter->count == 0)
+			continue;
+		xkl_debug(150, "%s: %u times, %" G_GINT64_FORMAT
+			  " usec\n", names[i], counter->count,
+			  counter->usec);
+	}
+}
+
 static void
 xkl_config_registry_finalize(GObject * obj)
 {
 	XklConfigRegistry *config = (XklConfigRegistry *) obj;
+	xkl_config_registry_dump_stats(config);
+	if (xkl_config_registry_get_engine(config) != NULL)
+		g_signal_handlers_disconnect_by_func
+		    (xkl_config_registry_get_engine(config),
+		     xkl_config_registry_config_changed, config);
 	xkl_config_registry_free(config);
+	xkl_config_registry_free_group_items(config);
+	if (xkl_config_registry_priv(config, search_pool) != NULL)
+		g_thread_pool_free(xkl_config_registry_priv
+				   (config, search_pool), FALSE, TRUE);
 	g_free(config->priv);
 	G_OBJECT_CLASS(parent_class)->finalize(obj);
 }
@@ -1125,18 +1402,6 @@ extern void
 xkl_config_registry_class_term(XklConfigRegistryClass * klass)
 {
 	gint i;
-	if (models_xpath != NULL) {
-		xmlXPathFreeCompExpr(models_xpath);
-		models_xpath = NULL;
-	}
-	if (layouts_xpath != NULL) {
-		xmlXPathFreeCompExpr(layouts_xpath);
-		layouts_xpath = NULL;
-	}
-	if (option_groups_xpath != NULL) {
-		xmlXPathFreeCompExpr(option_groups_xpath);
-		option_groups_xpath = NULL;
-	}
 	if (xml_encode_regexen != NULL) {
 		for (i =
 		     sizeof(xml_encode_regexen_str) /
@@ -1179,12 +1444,6 @@ xkl_config_registry_class_init(XklConfigRegistryClass * klass)
 					engine_param_spec);
 	/* static stuff initialized */
 	xmlXPathInit();
-	models_xpath = xmlXPathCompile((unsigned char *)
-				       XKBCR_MODEL_PATH);
-	layouts_xpath = xmlXPathCompile((unsigned char *)
-					XKBCR_LAYOUT_PATH);
-	option_groups_xpath = xmlXPathCompile((unsigned char *)
-					      XKBCR_GROUP_PATH);
 	xml_encode_regexen =
 	    g_new0(GRegex *,
 		   sizeof(xml_encode_regexen_str) /
@@ -0,0 +1,709 @@
+/*
+ * Copyright (C) 2002-2006 Sergey V. Udaltsov <svu@gnome.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+
+#include "config.h"
+
+#include "xklavier_private.h"
+
+#define XML_TAG_VARIANT_LIST "variantList"
+#define XML_TAG_VARIANT "variant"
+#define XML_TAG_OPTION "option"
+
+struct _XklConfigFilter {
+	XklConfigFilterTarget target;
+	gchar *vendor;
+	gchar *country;
+	gchar *language;
+	/* -1 means "any" */
+	gint extra_item;
+	gchar *parent;
+	gchar *name_prefix;
+};
+
+G_DEFINE_BOXED_TYPE(XklConfigFilter, xkl_config_filter,
+		    xkl_config_filter_copy, xkl_config_filter_free);
+
+static const gchar **
+xkl_config_index_copy_list(XklConfigIndex * index, gchar ** list)
+{
+	const gchar **copy;
+	gint i, n;
+
+	if (list == NULL || *list == NULL)
+		return NULL;
+
+	n = g_strv_length(list);
+	copy = g_new0(const gchar *, n + 1);
+	for (i = 0; i < n; i++)
+		copy[i] = g_string_chunk_insert_const(index->strings,
+						      list[i]);
+	g_ptr_array_add(index->lists, copy);
+	return copy;
+}
+
+static gint
+xkl_config_index_append(XklConfigIndex * index, GArray * table,
+			const XklConfigItem * ci, gint doc_index,
+			GArray * parents, gint parent)
+{
+	XklConfigIndexItem iitem;
+	const gchar *vendor =
+	    g_object_get_data(G_OBJECT(ci), XCI_PROP_VENDOR);
+	gint idx = table->len;
+
+	iitem.name = g_string_chunk_insert_const(index->strings, ci->name);
+	iitem.short_description =
+	    g_string_chunk_insert_const(index->strings,
+					ci->short_description);
+	iitem.description =
+	    g_string_chunk_insert_const(index->strings, ci->description);
+	iitem.vendor = vendor == NULL ? NULL :
+	    g_string_chunk_insert_const(index->strings, vendor);
+	iitem.countries =
+	    xkl_config_index_copy_list(index,
+				       g_object_get_data(G_OBJECT(ci),
+							 XCI_PROP_COUNTRY_LIST));
+	iitem.languages =
+	    xkl_config_index_copy_list(index,
+				       g_object_get_data(G_OBJECT(ci),
+							 XCI_PROP_LANGUAGE_LIST));
+	iitem.extra = doc_index > 0;
+	iitem.allow_multiple_selection = FALSE;
+	iitem.parent = parent;
+	iitem.first_child = iitem.last_child = iitem.next_sibling = -1;
+	g_array_append_val(table, iitem);
+
+	if (parents != NULL) {
+		XklConfigIndexItem *pitem =
+		    &g_array_index(parents, XklConfigIndexItem, parent);
+		if (pitem->last_child >= 0)
+			g_array_index(table, XklConfigIndexItem,
+				      pitem->last_child).next_sibling = idx;
+		else
+			pitem->first_child = idx;
+		pitem->last_child = idx;
+	}
+	return idx;
+}
+
+static gboolean
+xkl_config_index_has_child(GArray * parents, GArray * children,
+			   gint parent, const gchar * name)
+{
+	gint i = g_array_index(parents, XklConfigIndexItem,
+			       parent).first_child;
+	while (i >= 0) {
+		XklConfigIndexItem *child =
+		    &g_array_index(children, XklConfigIndexItem, i);
+		if (!g_ascii_strcasecmp(child->name, name))
+			return TRUE;
+		i = child->next_sibling;
+	}
+	return FALSE;
+}
+
+/*
+ * Adds all the element_tag children of the node,
+ * skipping the ones already known for that parent
+ */
+static void
+xkl_config_index_add_children(XklConfigRegistry * config,
+			      XklConfigIndex * index, GArray * parents,
+			      GArray * children, gint parent,
+			      gint doc_index, xmlNodePtr node,
+			      const gchar * element_tag, XklConfigItem * ci)
+{
+	for (; node != NULL; node = node->next) {
+		if (node->type != XML_ELEMENT_NODE
+		    || g_ascii_strcasecmp((const char *) node->name,
+					  element_tag))
+			continue;
+		if (!xkl_read_config_item(config, doc_index, node, ci))
+			continue;
+		if (xkl_config_index_has_child
+		    (parents, children, parent, ci->name))
+			continue;
+		xkl_config_index_append(index, children, ci, doc_index,
+					parents, parent);
+	}
+}
+
+static xmlNodeSetPtr
+xkl_config_index_eval(xmlXPathContextPtr xmlctxt, const gchar * path,
+		      xmlXPathObjectPtr * xpath_obj)
+{
+	*xpath_obj = xmlXPathEval((const xmlChar *) path, xmlctxt);
+	return *xpath_obj == NULL ? NULL : (*xpath_obj)->nodesetval;
+}
+
+static gint
+xkl_config_index_lookup(GHashTable * by_name, const gchar * name)
+{
+	return GPOINTER_TO_INT(g_hash_table_lookup(by_name, name)) - 1;
+}
+
+static gint
+xkl_config_index_add_parent(XklConfigIndex * index, GArray * table,
+			    GHashTable * by_name, const XklConfigItem * ci,
+			    gint doc_index)
+{
+	gint idx = xkl_config_index_lookup(by_name, ci->name);
+	if (idx < 0) {
+		idx = xkl_config_index_append(index, table, ci, doc_index,
+					      NULL, -1);
+		g_hash_table_insert(by_name, (gpointer)
+				    g_array_index(table, XklConfigIndexItem,
+						  idx).name,
+				    GINT_TO_POINTER(idx + 1));
+	}
+	return idx;
+}
+
+static gboolean
+xkl_config_index_read_multiple_selection(xmlNodePtr node)
+{
+	gboolean allow_multisel = FALSE;
+	xmlChar *sallow_multisel = xmlGetProp(node, (unsigned char *)
+					      XCI_PROP_ALLOW_MULTIPLE_SELECTION);
+	if (sallow_multisel != NULL) {
+		allow_multisel =
+		    !g_ascii_strcasecmp("true", (char *) sallow_multisel);
+		xmlFree(sallow_multisel);
+	}
+	return allow_multisel;
+}
+
+static void
+xkl_config_index_load_doc(XklConfigRegistry * config,
+			  XklConfigIndex * index, gint doc_index,
+			  XklConfigItem * ci, GHashTable * model_names)
+{
+	xmlXPathContextPtr xmlctxt =
+	    xkl_config_registry_priv(config, xpath_contexts[doc_index]);
+	xmlXPathObjectPtr xpath_obj;
+	xmlNodeSetPtr nodes;
+	gint i, n_groups;
+
+	nodes = xkl_config_index_eval(xmlctxt, XKBCR_MODEL_PATH, &xpath_obj);
+	for (i = 0; nodes != NULL && i < nodes->nodeNr; i++) {
+		if (!xkl_read_config_item
+		    (config, doc_index, nodes->nodeTab[i], ci))
+			continue;
+		if (xkl_config_index_lookup(model_names, ci->name) >= 0)
+			continue;
+		g_hash_table_insert(model_names,
+				    (gpointer)
+				    g_string_chunk_insert_const
+				    (index->strings, ci->name),
+				    GINT_TO_POINTER(index->models->len + 1));
+		xkl_config_index_append(index, index->models, ci,
+					doc_index, NULL, -1);
+	}
+	if (xpath_obj != NULL)
+		xmlXPathFreeObject(xpath_obj);
+
+	nodes =
+	    xkl_config_index_eval(xmlctxt, XKBCR_LAYOUT_PATH, &xpath_obj);
+	for (i = 0; nodes != NULL && i < nodes->nodeNr; i++) {
+		xmlNodePtr node = nodes->nodeTab[i];
+		gint layout;
+
+		if (!xkl_read_config_item(config, doc_index, node, ci))
+			continue;
+		layout =
+		    xkl_config_index_add_parent(index, index->layouts,
+						index->layouts_by_name, ci,
+						doc_index);
+		/* layout/variantList/variant */
+		for (node = node->children; node != NULL;
+		     node = node->next) {
+			if (node->type == XML_ELEMENT_NODE
+			    && !g_ascii_strcasecmp((const char *)
+						   node->name,
+						   XML_TAG_VARIANT_LIST))
+				xkl_config_index_add_children(config,
+							      index,
+							      index->layouts,
+							      index->variants,
+							      layout,
+							      doc_index,
+							      node->children,
+							      XML_TAG_VARIANT,
+							      ci);
+		}
+	}
+	if (xpath_obj != NULL)
+		xmlXPathFreeObject(xpath_obj);
+
+	nodes =
+	    xkl_config_index_eval(xmlctxt, XKBCR_GROUP_PATH, &xpath_obj);
+	for (i = 0; nodes != NULL && i < nodes->nodeNr; i++) {
+		xmlNodePtr node = nodes->nodeTab[i];
+		gint group;
+
+		if (!xkl_read_config_item(config, doc_index, node, ci))
+			continue;
+		n_groups = index->option_groups->len;
+		group =
+		    xkl_config_index_add_parent(index,
+						index->option_groups,
+						index->option_groups_by_name,
+						ci, doc_index);
+		/* the first definition of the group wins */
+		if (group == n_groups)
+			xkl_config_index_item(index, option_groups,
+					      group)->allow_multiple_selection
+			    = xkl_config_index_read_multiple_selection(node);
+		/* group/option */
+		xkl_config_index_add_children(config, index,
+					      index->option_groups,
+					      index->options, group,
+					      doc_index, node->children,
+					      XML_TAG_OPTION, ci);
+	}
+	if (xpath_obj != NULL)
+		xmlXPathFreeObject(xpath_obj);
+}
+
+XklConfigIndex *
+xkl_config_index_new_empty(void)
+{
+	XklConfigIndex *index = g_new0(XklConfigIndex, 1);
+	index->models =
+	    g_array_new(FALSE, FALSE, sizeof(XklConfigIndexItem));
+	index->layouts =
+	    g_array_new(FALSE, FALSE, sizeof(XklConfigIndexItem));
+	index->variants =
+	    g_array_new(FALSE, FALSE, sizeof(XklConfigIndexItem));
+	index->option_groups =
+	    g_array_new(FALSE, FALSE, sizeof(XklConfigIndexItem));
+	index->options =
+	    g_array_new(FALSE, FALSE, sizeof(XklConfigIndexItem));
+	index->layouts_by_name = g_hash_table_new(g_str_hash, g_str_equal);
+	index->option_groups_by_name =
+	    g_hash_table_new(g_str_hash, g_str_equal);
+	index->strings = g_string_chunk_new(16384);
+	index->lists = g_ptr_array_new_with_free_func(g_free);
+	return index;
+}
+
+XklConfigIndex *
+xkl_config_index_new(XklConfigRegistry * config)
+{
+	XklConfigIndex *index;
+	XklConfigItem *ci;
+	GHashTable *model_names;
+	gint64 start;
+	gint di;
+
+	if (xkl_config_registry_priv(config, xpath_contexts[0]) == NULL)
+		return NULL;
+
+	start = g_get_monotonic_time();
+	index = xkl_config_index_new_empty();
+	model_names = g_hash_table_new(g_str_hash, g_str_equal);
+	ci = xkl_config_item_new();
+	for (di = 0; di < XKL_NUMBER_OF_REGISTRY_DOCS; di++) {
+		if (xkl_config_registry_priv(config, xpath_contexts[di]) ==
+		    NULL)
+			continue;
+		xkl_config_index_load_doc(config, index, di, ci,
+					  model_names);
+	}
+	g_object_unref(G_OBJECT(ci));
+	g_hash_table_destroy(model_names);
+
+	xkl_debug(150,
+		  "Registry index: %d models, %d layouts, %d variants, %d option groups, %d options\n",
+		  index->models->len, index->layouts->len,
+		  index->variants->len, index->option_groups->len,
+		  index->options->len);
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_LOAD_INDEX,
+				     start);
+	return index;
+}
+
+void
+xkl_config_index_free(XklConfigIndex * index)
+{
+	if (index == NULL)
+		return;
+	g_array_free(index->models, TRUE);
+	g_array_free(index->layouts, TRUE);
+	g_array_free(index->variants, TRUE);
+	g_array_free(index->option_groups, TRUE);
+	g_array_free(index->options, TRUE);
+	g_hash_table_destroy(index->layouts_by_name);
+	g_hash_table_destroy(index->option_groups_by_name);
+	g_ptr_array_free(index->lists, TRUE);
+	g_string_chunk_free(index->strings);
+	if (index->country_names != NULL)
+		g_hash_table_destroy(index->country_names);
+	if (index->language_names != NULL)
+		g_hash_table_destroy(index->language_names);
+	if (index->snapshot != NULL)
+		g_mapped_file_unref(index->snapshot);
+	xkl_config_search_data_free(index->search);
+	g_free(index);
+}
+
+gint
+xkl_config_index_find_layout(XklConfigIndex * index, const gchar * name)
+{
+	return xkl_config_index_lookup(index->layouts_by_name, name);
+}
+
+gint
+xkl_config_index_find_option_group(XklConfigIndex * index,
+				   const gchar * name)
+{
+	return xkl_config_index_lookup(index->option_groups_by_name, name);
+}
+
+const gchar *
+xkl_config_index_get_country_name(XklConfigIndex * index,
+				  const gchar * code)
+{
+	if (index->country_names != NULL)
+		return g_hash_table_lookup(index->country_names, code);
+	return xkl_get_country_name(code);
+}
+
+const gchar *
+xkl_config_index_get_language_name(XklConfigIndex * index,
+				   const gchar * code)
+{
+	if (index->language_names != NULL)
+		return g_hash_table_lookup(index->language_names, code);
+	return xkl_get_language_name(code);
+}
+
+void
+xkl_config_index_item_fill(const XklConfigIndexItem * iitem,
+			   XklConfigItem * item)
+{
+	g_strlcpy(item->name, iitem->name, sizeof item->name);
+	g_strlcpy(item->short_description, iitem->short_description,
+		  sizeof item->short_description);
+	g_strlcpy(item->description, iitem->description,
+		  sizeof item->description);
+	g_object_set_data_full(G_OBJECT(item), XCI_PROP_VENDOR,
+			       g_strdup(iitem->vendor), g_free);
+	g_object_set_data_full(G_OBJECT(item), XCI_PROP_COUNTRY_LIST,
+			       g_strdupv((gchar **) iitem->countries),
+			       (GDestroyNotify) g_strfreev);
+	g_object_set_data_full(G_OBJECT(item), XCI_PROP_LANGUAGE_LIST,
+			       g_strdupv((gchar **) iitem->languages),
+			       (GDestroyNotify) g_strfreev);
+	g_object_set_data(G_OBJECT(item), XCI_PROP_EXTRA_ITEM,
+			  GINT_TO_POINTER(iitem->extra));
+}
+
+void
+xkl_config_index_group_fill(const XklConfigIndexItem * iitem,
+			    XklConfigItem * item)
+{
+	xkl_config_index_item_fill(iitem, item);
+	g_object_set_data(G_OBJECT(item), XCI_PROP_ALLOW_MULTIPLE_SELECTION,
+			  GINT_TO_POINTER(iitem->allow_multiple_selection));
+}
+
+XklConfigFilter *
+xkl_config_filter_new(XklConfigFilterTarget target)
+{
+	XklConfigFilter *filter = g_new0(XklConfigFilter, 1);
+	filter->target = target;
+	filter->extra_item = -1;
+	return filter;
+}
+
+XklConfigFilter *
+xkl_config_filter_copy(const XklConfigFilter * filter)
+{
+	XklConfigFilter *copy = g_new0(XklConfigFilter, 1);
+	copy->target = filter->target;
+	copy->vendor = g_strdup(filter->vendor);
+	copy->country = g_strdup(filter->country);
+	copy->language = g_strdup(filter->language);
+	copy->extra_item = filter->extra_item;
+	copy->parent = g_strdup(filter->parent);
+	copy->name_prefix = g_strdup(filter->name_prefix);
+	return copy;
+}
+
+void
+xkl_config_filter_free(XklConfigFilter * filter)
+{
+	if (filter == NULL)
+		return;
+	g_free(filter->vendor);
+	g_free(filter->country);
+	g_free(filter->language);
+	g_free(filter->parent);
+	g_free(filter->name_prefix);
+	g_free(filter);
+}
+
+#define XKL_CONFIG_FILTER_SETTER(field) \
+	g_free(filter->field); \
+	filter->field = g_strdup(field)
+
+void
+xkl_config_filter_set_vendor(XklConfigFilter * filter,
+			     const gchar * vendor)
+{
+	XKL_CONFIG_FILTER_SETTER(vendor);
+}
+
+void
+xkl_config_filter_set_country(XklConfigFilter * filter,
+			      const gchar * country)
+{
+	XKL_CONFIG_FILTER_SETTER(country);
+}
+
+void
+xkl_config_filter_set_language(XklConfigFilter * filter,
+			       const gchar * language)
+{
+	XKL_CONFIG_FILTER_SETTER(language);
+}
+
+void
+xkl_config_filter_set_parent(XklConfigFilter * filter,
+			     const gchar * parent)
+{
+	XKL_CONFIG_FILTER_SETTER(parent);
+}
+
+void
+xkl_config_filter_set_name_prefix(XklConfigFilter * filter,
+				  const gchar * name_prefix)
+{
+	XKL_CONFIG_FILTER_SETTER(name_prefix);
+}
+
+void
+xkl_config_filter_set_extra_item(XklConfigFilter * filter,
+				 gboolean extra_item)
+{
+	filter->extra_item = extra_item ? 1 : 0;
+}
+
+static gboolean
+xkl_config_filter_list_contains(const gchar ** list, const gchar * code)
+{
+	for (; list != NULL && *list != NULL; list++)
+		if (!g_ascii_strcasecmp(*list, code))
+			return TRUE;
+	return FALSE;
+}
+
+static gboolean
+xkl_config_filter_matches(const XklConfigFilter * filter,
+			  const XklConfigIndexItem * iitem,
+			  const XklConfigIndexItem * parent)
+{
+	if (filter->name_prefix != NULL
+	    && !g_str_has_prefix(iitem->name, filter->name_prefix))
+		return FALSE;
+
+	if (filter->extra_item >= 0
+	    && filter->extra_item != (iitem->extra ? 1 : 0))
+		return FALSE;
+
+	if (filter->vendor != NULL
+	    && (iitem->vendor == NULL
+		|| g_ascii_strcasecmp(iitem->vendor, filter->vendor)))
+		return FALSE;
+
+	if (filter->country != NULL
+	    && !xkl_config_filter_list_contains(iitem->countries == NULL
+						&& parent !=
+						NULL ? parent->countries :
+						iitem->countries,
+						filter->country))
+		return FALSE;
+
+	if (filter->language != NULL
+	    && !xkl_config_filter_list_contains(iitem->languages == NULL
+						&& parent !=
+						NULL ? parent->languages :
+						iitem->languages,
+						filter->language))
+		return FALSE;
+
+	return TRUE;
+}
+
+static void
+xkl_config_filter_apply_to_table(XklConfigRegistry * config,
+				 const XklConfigFilter * filter,
+				 GArray * table,
+				 XklConfigIndexFillFunc fill,
+				 XklTwoConfigItemsProcessFunc func,
+				 gpointer data)
+{
+	XklConfigItem *ci;
+	guint i;
+
+	/* top-level items have no parents */
+	if (filter->parent != NULL)
+		return;
+
+	ci = xkl_config_item_new();
+	for (i = 0; i < table->len; i++) {
+		const XklConfigIndexItem *iitem =
+		    &g_array_index(table, XklConfigIndexItem, i);
+		if (!xkl_config_filter_matches(filter, iitem, NULL))
+			continue;
+		fill(iitem, ci);
+		func(config, ci, NULL, data);
+	}
+	g_object_unref(G_OBJECT(ci));
+}
+
+static void
+xkl_config_filter_apply_to_children(XklConfigRegistry * config,
+				    const XklConfigFilter * filter,
+				    GArray * parents, GArray * children,
+				    gint parent,
+				    XklConfigIndexFillFunc parent_fill,
+				    XklTwoConfigItemsProcessFunc func,
+				    gpointer data)
+{
+	XklConfigItem *parent_ci = NULL, *ci = NULL;
+	guint first = 0, last = parents->len;
+	guint p;
+
+	if (parent >= 0) {
+		first = parent;
+		last = parent + 1;
+	}
+
+	for (p = first; p < last; p++) {
+		const XklConfigIndexItem *pitem =
+		    &g_array_index(parents, XklConfigIndexItem, p);
+		gboolean parent_filled = FALSE;
+		gint i;
+
+		for (i = pitem->first_child; i >= 0;
+		     i = g_array_index(children, XklConfigIndexItem,
+				       i).next_sibling) {
+			const XklConfigIndexItem *iitem =
+			    &g_array_index(children, XklConfigIndexItem,
+					   i);
+			if (!xkl_config_filter_matches(filter, iitem, pitem))
+				continue;
+			if (ci == NULL) {
+				ci = xkl_config_item_new();
+				parent_ci = xkl_config_item_new();
+			}
+			if (!parent_filled) {
+				parent_fill(pitem, parent_ci);
+				parent_filled = TRUE;
+			}
+			xkl_config_index_item_fill(iitem, ci);
+			func(config, parent_ci, ci, data);
+		}
+	}
+
+	if (ci != NULL) {
+		g_object_unref(G_OBJECT(ci));
+		g_object_unref(G_OBJECT(parent_ci));
+	}
+}
+
+static void
+xkl_config_filter_apply(XklConfigRegistry * config,
+			XklConfigIndex * index,
+			const XklConfigFilter * filter,
+			XklTwoConfigItemsProcessFunc func, gpointer data)
+{
+	gint parent = -1;
+
+	switch (filter->target) {
+	case XKL_CONFIG_FILTER_MODELS:
+		xkl_config_filter_apply_to_table(config, filter,
+						 index->models,
+						 xkl_config_index_item_fill,
+						 func, data);
+		break;
+	case XKL_CONFIG_FILTER_LAYOUTS:
+		xkl_config_filter_apply_to_table(config, filter,
+						 index->layouts,
+						 xkl_config_index_item_fill,
+						 func, data);
+		break;
+	case XKL_CONFIG_FILTER_OPTION_GROUPS:
+		xkl_config_filter_apply_to_table(config, filter,
+						 index->option_groups,
+						 xkl_config_index_group_fill,
+						 func, data);
+		break;
+	case XKL_CONFIG_FILTER_VARIANTS:
+		if (filter->parent != NULL) {
+			parent =
+			    xkl_config_index_find_layout(index,
+							 filter->parent);
+			if (parent < 0)
+				return;
+		}
+		xkl_config_filter_apply_to_children(config, filter,
+						    index->layouts,
+						    index->variants, parent,
+						    xkl_config_index_item_fill,
+						    func, data);
+		break;
+	case XKL_CONFIG_FILTER_OPTIONS:
+		if (filter->parent != NULL) {
+			parent =
+			    xkl_config_index_find_option_group(index,
+							       filter->parent);
+			if (parent < 0)
+				return;
+		}
+		xkl_config_filter_apply_to_children(config, filter,
+						    index->option_groups,
+						    index->options, parent,
+						    xkl_config_index_group_fill,
+						    func, data);
+		break;
+	}
+}
+
+void
+xkl_config_registry_foreach_filtered(XklConfigRegistry * config,
+				     const XklConfigFilter * filter,
+				     XklTwoConfigItemsProcessFunc func,
+				     gpointer data)
+{
+	XklConfigIndex *index = xkl_config_registry_priv(config, index);
+	gint64 start = g_get_monotonic_time();
+
+	if (index != NULL)
+		xkl_config_filter_apply(config, index, filter, func, data);
+
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_FOREACH_FILTERED,
+				     start);
+}
@@ -0,0 +1,512 @@
+/*
+ * Copyright (C) 2002-2006 Sergey V. Udaltsov <svu@gnome.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "xklavier_private.h"
+
+#define XKL_STREAM_BUFFER_SIZE 65536
+
+/* Enough to tell gzip from zstd from plain XML */
+#define XKL_STREAM_MAGIC_SIZE 4
+
+typedef enum {
+	XKL_STREAM_PLAIN,
+	XKL_STREAM_GZIP,
+	XKL_STREAM_ZSTD
+} XklStreamCodec;
+
+/*
+ * Input of the XML parser: either a file descriptor or a memory region,
+ * optionally compressed. Compressed data is inflated chunk by chunk
+ * straight into the parser buffers, memory regions are never copied.
+ */
+typedef struct {
+	gint fd;
+	const guchar *mem;
+	gsize mem_size;
+
+	/* current window of raw (possibly compressed) input */
+	const guchar *in;
+	gsize in_len;
+	gboolean eof;
+
+	XklStreamCodec codec;
+	gboolean codec_inited;
+#ifdef HAVE_ZLIB
+	z_stream zs;
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_DStream *zds;
+#endif
+	guchar buffer[XKL_STREAM_BUFFER_SIZE];
+} XklConfigStream;
+
+static gboolean
+xkl_config_stream_is_gzip(const guchar * data, gsize len)
+{
+	return len >= 2 && data[0] == 0x1f && data[1] == 0x8b;
+}
+
+static gboolean
+xkl_config_stream_is_zstd(const guchar * data, gsize len)
+{
+	return len >= 4 && data[0] == 0x28 && data[1] == 0xb5 &&
+	    data[2] == 0x2f && data[3] == 0xfd;
+}
+
+/* Returns 1 if some input is available, 0 on EOF, -1 on error */
+static gint
+xkl_config_stream_fill(XklConfigStream * stream)
+{
+	gssize n;
+
+	if (stream->in_len > 0)
+		return 1;
+	if (stream->eof)
+		return 0;
+
+	if (stream->fd == -1) {
+		stream->in = stream->mem;
+		stream->in_len = stream->mem_size;
+		stream->eof = TRUE;
+		return stream->in_len > 0 ? 1 : 0;
+	}
+
+	do
+		n = read(stream->fd, stream->buffer, sizeof stream->buffer);
+	while (n < 0 && errno == EINTR);
+
+	if (n < 0) {
+		xkl_debug(0, "Could not read registry: %s\n",
+			  g_strerror(errno));
+		return -1;
+	}
+	if (n == 0) {
+		stream->eof = TRUE;
+		return 0;
+	}
+	stream->in = stream->buffer;
+	stream->in_len = n;
+	return 1;
+}
+
+/* Makes sure the first bytes are in the window, for the magic check */
+static gboolean
+xkl_config_stream_peek(XklConfigStream * stream)
+{
+	gssize n;
+
+	if (stream->fd == -1)
+		return xkl_config_stream_fill(stream) >= 0;
+
+	stream->in = stream->buffer;
+	while (stream->in_len < XKL_STREAM_MAGIC_SIZE) {
+		n = read(stream->fd, stream->buffer + stream->in_len,
+			 sizeof stream->buffer - stream->in_len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			xkl_debug(0, "Could not read registry: %s\n",
+				  g_strerror(errno));
+			return FALSE;
+		}
+		if (n == 0) {
+			stream->eof = TRUE;
+			break;
+		}
+		stream->in_len += n;
+	}
+	return TRUE;
+}
+
+static gboolean
+xkl_config_stream_init_codec(XklConfigStream * stream)
+{
+	if (xkl_config_stream_is_gzip(stream->in, stream->in_len))
+		stream->codec = XKL_STREAM_GZIP;
+	else if (xkl_config_stream_is_zstd(stream->in, stream->in_len))
+		stream->codec = XKL_STREAM_ZSTD;
+	else
+		stream->codec = XKL_STREAM_PLAIN;
+
+	switch (stream->codec) {
+	case XKL_STREAM_PLAIN:
+		break;
+	case XKL_STREAM_GZIP:
+#ifdef HAVE_ZLIB
+		memset(&stream->zs, 0, sizeof stream->zs);
+		/* 15 + 16: gzip wrapper, maximum window */
+		if (inflateInit2(&stream->zs, 15 + 16) != Z_OK) {
+			xkl_last_error_message =
+			    "Could not initialize gzip decompression";
+			return FALSE;
+		}
+		break;
+#else
+		xkl_last_error_message =
+		    "gzip-compressed registry is not supported";
+		return FALSE;
+#endif
+	case XKL_STREAM_ZSTD:
+#ifdef HAVE_ZSTD
+		stream->zds = ZSTD_createDStream();
+		if (stream->zds == NULL ||
+		    ZSTD_isError(ZSTD_initDStream(stream->zds))) {
+			xkl_last_error_message =
+			    "Could not initialize zstd decompression";
+			return FALSE;
+		}
+		break;
+#else
+		xkl_last_error_message =
+		    "zstd-compressed registry is not supported";
+		return FALSE;
+#endif
+	}
+	stream->codec_inited = TRUE;
+	return TRUE;
+}
+
+static void
+xkl_config_stream_term_codec(XklConfigStream * stream)
+{
+	if (!stream->codec_inited)
+		return;
+	stream->codec_inited = FALSE;
+	switch (stream->codec) {
+	case XKL_STREAM_PLAIN:
+		break;
+	case XKL_STREAM_GZIP:
+#ifdef HAVE_ZLIB
+		inflateEnd(&stream->zs);
+#endif
+		break;
+	case XKL_STREAM_ZSTD:
+#ifdef HAVE_ZSTD
+		ZSTD_freeDStream(stream->zds);
+		stream->zds = NULL;
+#endif
+		break;
+	}
+}
+
+static gint
+xkl_config_stream_read_plain(XklConfigStream * stream, guchar * out,
+			     gsize len)
+{
+	gint rv = xkl_config_stream_fill(stream);
+	if (rv <= 0)
+		return rv;
+
+	len = MIN(len, stream->in_len);
+	memcpy(out, stream->in, len);
+	stream->in += len;
+	stream->in_len -= len;
+	return len;
+}
+
+#ifdef HAVE_ZLIB
+static gint
+xkl_config_stream_read_gzip(XklConfigStream * stream, guchar * out,
+			    gsize len)
+{
+	z_stream *zs = &stream->zs;
+
+	zs->next_out = out;
+	zs->avail_out = len;
+
+	while (zs->avail_out == len) {
+		gint rv;
+
+		if (stream->in_len == 0) {
+			rv = xkl_config_stream_fill(stream);
+			if (rv < 0)
+				return -1;
+			if (rv == 0)
+				break;
+		}
+		zs->next_in = (Bytef *) stream->in;
+		zs->avail_in = stream->in_len;
+
+		rv = inflate(zs, Z_NO_FLUSH);
+
+		stream->in = zs->next_in;
+		stream->in_len = zs->avail_in;
+
+		if (rv == Z_STREAM_END) {
+			/* concatenated members are legal in gzip files */
+			if (stream->in_len == 0
+			    && xkl_config_stream_fill(stream) <= 0)
+				break;
+			inflateReset(zs);
+		} else if (rv != Z_OK && rv != Z_BUF_ERROR) {
+			xkl_debug(0, "gzip error: %s\n",
+				  zs->msg ? zs->msg : "unknown");
+			return -1;
+		}
+	}
+	return len - zs->avail_out;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static gint
+xkl_config_stream_read_zstd(XklConfigStream * stream, guchar * out,
+			    gsize len)
+{
+	ZSTD_outBuffer output = { out, len, 0 };
+
+	while (output.pos == 0) {
+		ZSTD_inBuffer input;
+		size_t rv;
+
+		if (stream->in_len == 0) {
+			gint frv = xkl_config_stream_fill(stream);
+			if (frv < 0)
+				return -1;
+			if (frv == 0)
+				break;
+		}
+		input.src = stream->in;
+		input.size = stream->in_len;
+		input.pos = 0;
+
+		rv = ZSTD_decompressStream(stream->zds, &output, &input);
+
+		stream->in += input.pos;
+		stream->in_len -= input.pos;
+
+		if (ZSTD_isError(rv)) {
+			xkl_debug(0, "zstd error: %s\n",
+				  ZSTD_getErrorName(rv));
+			return -1;
+		}
+	}
+	return output.pos;
+}
+#endif
+
+static int
+xkl_config_stream_read(void *context, char *buffer, int len)
+{
+	XklConfigStream *stream = (XklConfigStream *) context;
+
+	switch (stream->codec) {
+	case XKL_STREAM_PLAIN:
+		return xkl_config_stream_read_plain(stream,
+						    (guchar *) buffer,
+						    len);
+#ifdef HAVE_ZLIB
+	case XKL_STREAM_GZIP:
+		return xkl_config_stream_read_gzip(stream,
+						   (guchar *) buffer, len);
+#endif
+#ifdef HAVE_ZSTD
+	case XKL_STREAM_ZSTD:
+		return xkl_config_stream_read_zstd(stream,
+						   (guchar *) buffer, len);
+#endif
+	default:
+		return -1;
+	}
+}
+
+static int
+xkl_config_stream_close(void *context)
+{
+	xkl_config_stream_term_codec((XklConfigStream *) context);
+	return 0;
+}
+
+static gboolean
+xkl_config_registry_attach_doc(XklConfigRegistry * config, gint docidx,
+			       xmlDocPtr doc)
+{
+	gint64 start;
+
+	xkl_config_registry_priv(config, docs[docidx]) = doc;
+
+	if (doc == NULL) {
+		xkl_config_registry_priv(config, xpath_contexts[docidx]) =
+		    NULL;
+		return FALSE;
+	}
+
+	start = g_get_monotonic_time();
+	xkl_config_registry_priv(config, xpath_contexts[docidx]) =
+	    xmlXPathNewContext(doc);
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_LOAD_XPATH,
+				     start);
+
+	return TRUE;
+}
+
+static xmlDocPtr
+xkl_config_registry_parse_failed(void)
+{
+	xkl_last_error_message =
+	    "Could not parse primary XKB configuration registry";
+	return NULL;
+}
+
+static xmlDocPtr
+xkl_config_stream_parse(XklConfigStream * stream, const gchar * url)
+{
+	xmlParserCtxtPtr ctxt;
+	xmlDocPtr doc;
+
+	if (!xkl_config_stream_peek(stream))
+		return NULL;
+	if (!xkl_config_stream_init_codec(stream))
+		return NULL;
+
+	ctxt = xmlNewParserCtxt();
+	xmlSAX2InitDefaultSAXHandler(ctxt->sax, TRUE);
+
+	/* libxml2 invokes the close callback, the stream is ours to free */
+	doc = xmlCtxtReadIO(ctxt, xkl_config_stream_read,
+			    xkl_config_stream_close, stream, url, NULL,
+			    XML_PARSE_NOBLANKS);
+	xmlFreeParserCtxt(ctxt);
+
+	xkl_config_stream_term_codec(stream);
+	return doc != NULL ? doc : xkl_config_registry_parse_failed();
+}
+
+static gboolean
+xkl_config_registry_load_from_stream(XklConfigRegistry * config,
+				     gint fd, const gchar * url,
+				     gint docidx)
+{
+	XklConfigStream *stream = g_new0(XklConfigStream, 1);
+	gint64 start = g_get_monotonic_time();
+	xmlDocPtr doc;
+
+	stream->fd = fd;
+	doc = xkl_config_stream_parse(stream, url);
+	g_free(stream);
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_LOAD_PARSE,
+				     start);
+
+	return xkl_config_registry_attach_doc(config, docidx, doc);
+}
+
+/* We process descriptions as "leaf" elements - this is ok for base.xml*/
+gboolean
+xkl_config_registry_load_from_file(XklConfigRegistry * config,
+				   const gchar * file_name, gint docidx)
+{
+	gboolean rv;
+	gint fd;
+
+	xkl_debug(100, "Loading XML registry from file %s\n", file_name);
+
+	do
+		fd = open(file_name, O_RDONLY | O_CLOEXEC);
+	while (fd == -1 && errno == EINTR);
+
+	if (fd == -1) {
+		xkl_debug(0, "Could not open registry file %s: %s\n",
+			  file_name, g_strerror(errno));
+		xkl_last_error_message = "Could not open registry file";
+		return xkl_config_registry_attach_doc(config, docidx,
+						      NULL);
+	}
+
+	rv = xkl_config_registry_load_from_stream(config, fd, file_name,
+						  docidx);
+	close(fd);
+
+	/* snapshots of the registry are checked against the file */
+	if (rv)
+		xkl_config_registry_priv(config, doc_files[docidx]) =
+		    g_strdup(file_name);
+	return rv;
+}
+
+gboolean
+xkl_config_registry_load_from_fd_doc(XklConfigRegistry * config,
+				     gint fd, gint docidx)
+{
+	xkl_debug(100, "Loading XML registry from fd %d\n", fd);
+
+	return xkl_config_registry_load_from_stream(config, fd, NULL,
+						    docidx);
+}
+
+gboolean
+xkl_config_registry_load_from_memory(XklConfigRegistry * config,
+				     gconstpointer data, gsize size,
+				     gint docidx)
+{
+	XklConfigStream *stream;
+	xmlParserCtxtPtr ctxt;
+	xmlDocPtr doc;
+	gint64 start;
+
+	xkl_debug(100, "Loading XML registry from memory, %"
+		  G_GSIZE_FORMAT " bytes\n", size);
+
+	if (size > G_MAXINT) {
+		xkl_last_error_message = "Registry buffer is too large";
+		return xkl_config_registry_attach_doc(config, docidx, NULL);
+	}
+
+	start = g_get_monotonic_time();
+
+	/* plain XML is handed to the parser as it is */
+	if (!xkl_config_stream_is_gzip(data, size) &&
+	    !xkl_config_stream_is_zstd(data, size)) {
+		ctxt = xmlNewParserCtxt();
+		xmlSAX2InitDefaultSAXHandler(ctxt->sax, TRUE);
+		doc = xmlCtxtReadMemory(ctxt, data, size, NULL, NULL,
+					XML_PARSE_NOBLANKS);
+		xmlFreeParserCtxt(ctxt);
+		if (doc == NULL)
+			xkl_config_registry_parse_failed();
+	} else {
+		stream = g_new0(XklConfigStream, 1);
+		stream->fd = -1;
+		stream->mem = data;
+		stream->mem_size = size;
+		doc = xkl_config_stream_parse(stream, NULL);
+		g_free(stream);
+	}
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_LOAD_PARSE,
+				     start);
+
+	return xkl_config_registry_attach_doc(config, docidx, doc);
+}
@@ -29,9 +29,6 @@
 
 #include "xklavier_private.h"
 
-#define ISO_CODES_DATADIR    ISO_CODES_PREFIX "/share/xml/iso-codes"
-#define ISO_CODES_LOCALESDIR ISO_CODES_PREFIX "/share/locale"
-
 static GHashTable *country_code_names = NULL;
 static GHashTable *lang_code_names = NULL;
 
@@ -162,8 +159,6 @@ iso_code_names_init(LookupParams * params)
 	return ht;
 }
 
-typedef const gchar *(*DescriptionGetterFunc) (const gchar * code);
-
 const gchar *
 xkl_get_language_name(const gchar * code)
 {
@@ -198,74 +193,42 @@ xkl_get_country_name(const gchar * code)
 	return dgettext("iso_3166", name);
 }
 
+typedef const gchar *(*XklIndexNameGetterFunc) (XklConfigIndex * index,
+						 const gchar * code);
+
+static void
+xkl_config_iso_add_code(GHashTable * code_pairs, XklConfigIndex * index,
+			const gchar * iso_code, XklIndexNameGetterFunc dgf)
+{
+	const gchar *description = dgf(index, iso_code);
+/* If there is a mapping to some ISO description - consider it as ISO code (well, it is just an assumption) */
+	if (description)
+		g_hash_table_insert(code_pairs, g_strdup(iso_code),
+				    g_strdup(description));
+}
+
+static void
+xkl_config_iso_add_codes(GHashTable * code_pairs, XklConfigIndex * index,
+			 const gchar ** codes, XklIndexNameGetterFunc dgf,
+			 gboolean to_upper)
+{
+	for (; codes != NULL && *codes != NULL; codes++) {
+		gchar *iso_code = to_upper ?
+		    g_ascii_strup(*codes, -1) : g_strdup(*codes);
+		xkl_config_iso_add_code(code_pairs, index, iso_code, dgf);
+		g_free(iso_code);
+	}
+}
+
 static void
 xkl_config_registry_foreach_iso_code(XklConfigRegistry * config,
 				     XklConfigItemProcessFunc func,
-				     const gchar * xpath_exprs[],
-				     DescriptionGetterFunc dgf,
-				     gboolean to_upper, gpointer data)
+				     GHashTable * code_pairs,
+				     gpointer data)
 {
-	GHashTable *code_pairs;
 	GHashTableIter iter;
-	xmlXPathObjectPtr xpath_obj;
-	const gchar **xpath_expr;
 	gpointer key, value;
 	XklConfigItem *ci;
-	gint di;
-
-	if (!xkl_config_registry_is_initialized(config))
-		return;
-
-	code_pairs = g_hash_table_new(g_str_hash, g_str_equal);
-
-	for (xpath_expr = xpath_exprs; *xpath_expr; xpath_expr++) {
-		for (di = 0; di < XKL_NUMBER_OF_REGISTRY_DOCS; di++) {
-			gint ni;
-			xmlNodePtr *node;
-			xmlNodeSetPtr nodes;
-
-			xmlXPathContextPtr xmlctxt =
-			    xkl_config_registry_priv(config,
-						     xpath_contexts[di]);
-			if (xmlctxt == NULL)
-				continue;
-
-			xpath_obj =
-			    xmlXPathEval((unsigned char *) *xpath_expr,
-					 xmlctxt);
-			if (xpath_obj == NULL)
-				continue;
-
-			nodes = xpath_obj->nodesetval;
-			if (nodes == NULL) {
-				xmlXPathFreeObject(xpath_obj);
-				continue;
-			}
-
-			node = nodes->nodeTab;
-			for (ni = nodes->nodeNr; --ni >= 0;) {
-				gchar *iso_code =
-				    (gchar *) (*node)->children->content;
-				const gchar *description;
-				iso_code =
-				    to_upper ?
-				    g_ascii_strup(iso_code,
-						  -1) : g_strdup(iso_code);
-				description = dgf(iso_code);
-/* If there is a mapping to some ISO description - consider it as ISO code (well, it is just an assumption) */
-				if (description)
-					g_hash_table_insert
-					    (code_pairs,
-					     g_strdup
-					     (iso_code),
-					     g_strdup(description));
-				g_free(iso_code);
-				node++;
-			}
-
-			xmlXPathFreeObject(xpath_obj);
-		}
-	}
 
 	g_hash_table_iter_init(&iter, code_pairs);
 	ci = xkl_config_item_new();
@@ -276,7 +239,60 @@ xkl_config_registry_foreach_iso_code(XklConfigRegistry * config,
 		func(config, ci, data);
 	}
 	g_object_unref(G_OBJECT(ci));
-	g_hash_table_unref(code_pairs);
+}
+
+static GHashTable *
+xkl_config_iso_country_codes(XklConfigIndex * index)
+{
+	GHashTable *code_pairs;
+	guint i;
+
+	code_pairs = g_hash_table_new_full(g_str_hash, g_str_equal,
+					   g_free, g_free);
+
+	/* the countries of the layouts, then the layouts named after them */
+	for (i = 0; i < index->layouts->len; i++)
+		xkl_config_iso_add_codes(code_pairs, index,
+					 xkl_config_index_item(index,
+							       layouts,
+							       i)->countries,
+					 xkl_config_index_get_country_name,
+					 TRUE);
+	for (i = 0; i < index->layouts->len; i++) {
+		gchar *iso_code =
+		    g_ascii_strup(xkl_config_index_item(index, layouts, i)->
+				  name, -1);
+		xkl_config_iso_add_code(code_pairs, index, iso_code,
+					xkl_config_index_get_country_name);
+		g_free(iso_code);
+	}
+	return code_pairs;
+}
+
+static GHashTable *
+xkl_config_iso_language_codes(XklConfigIndex * index)
+{
+	GHashTable *code_pairs;
+	guint i;
+
+	code_pairs = g_hash_table_new_full(g_str_hash, g_str_equal,
+					   g_free, g_free);
+
+	for (i = 0; i < index->layouts->len; i++)
+		xkl_config_iso_add_codes(code_pairs, index,
+					 xkl_config_index_item(index,
+							       layouts,
+							       i)->languages,
+					 xkl_config_index_get_language_name,
+					 FALSE);
+	for (i = 0; i < index->variants->len; i++)
+		xkl_config_iso_add_codes(code_pairs, index,
+					 xkl_config_index_item(index,
+							       variants,
+							       i)->languages,
+					 xkl_config_index_get_language_name,
+					 FALSE);
+	return code_pairs;
 }
 
 void
@@ -285,15 +301,20 @@ xkl_config_registry_foreach_country(XklConfigRegistry *
 				    XklConfigItemProcessFunc
 				    func, gpointer data)
 {
-	const gchar *xpath_exprs[] = {
-		XKBCR_LAYOUT_PATH "/configItem/countryList/iso3166Id",
-		XKBCR_LAYOUT_PATH "/configItem/name",
-		NULL
-	};
-
-	xkl_config_registry_foreach_iso_code(config, func, xpath_exprs,
-					     xkl_get_country_name, TRUE,
-					     data);
+	XklConfigIndex *index = xkl_config_registry_priv(config, index);
+	gint64 start = g_get_monotonic_time();
+	GHashTable *code_pairs;
+
+	if (index != NULL) {
+		code_pairs = xkl_config_iso_country_codes(index);
+		xkl_config_registry_foreach_iso_code(config, func,
+						     code_pairs, data);
+		g_hash_table_destroy(code_pairs);
+	}
+
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_FOREACH_COUNTRY,
+				     start);
 }
 
 void
@@ -302,136 +323,131 @@ xkl_config_registry_foreach_language(XklConfigRegistry *
 				     XklConfigItemProcessFunc
 				     func, gpointer data)
 {
-	const gchar *xpath_exprs[] = {
-		XKBCR_LAYOUT_PATH "/configItem/languageList/iso639Id",
-		XKBCR_VARIANT_PATH "/configItem/languageList/iso639Id",
-		NULL
-	};
-
-	xkl_config_registry_foreach_iso_code(config, func, xpath_exprs,
-					     xkl_get_language_name, FALSE,
-					     data);
+	XklConfigIndex *index = xkl_config_registry_priv(config, index);
+	gint64 start = g_get_monotonic_time();
+	GHashTable *code_pairs;
+
+	if (index != NULL) {
+		code_pairs = xkl_config_iso_language_codes(index);
+		xkl_config_registry_foreach_iso_code(config, func,
+						     code_pairs, data);
+		g_hash_table_destroy(code_pairs);
+	}
+
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_FOREACH_LANGUAGE,
+				     start);
 }
 
-void
+static const gchar **
+xkl_config_iso_list(const XklConfigIndexItem * iitem, gboolean countries)
+{
+	return countries ? iitem->countries : iitem->languages;
+}
+
+static gboolean
+xkl_config_iso_list_contains(const gchar ** list, const gchar * code)
+{
+	for (; list != NULL && *list != NULL; list++)
+		if (!strcmp(*list, code))
+			return TRUE;
+	return FALSE;
+}
+
+/*
+ * The layout matches if the code is in its list or, when name is not NULL,
+ * if the layout is called so
+ */
+static gboolean
+xkl_config_iso_layout_matches(const XklConfigIndexItem * litem,
+			      gboolean countries, const gchar * code,
+			      const gchar * name)
+{
+	if (name != NULL)
+		return !strcmp(litem->name, name);
+	return xkl_config_iso_list_contains(xkl_config_iso_list
+					    (litem, countries), code);
+}
+
+static void
 xkl_config_registry_foreach_iso_variant(XklConfigRegistry *
 					config,
 					const gchar *
 					iso_code,
+					gboolean countries,
 					XklTwoConfigItemsProcessFunc
-					func, gpointer data,
-					const gchar * layout_xpath_exprs[],
-					const gboolean
-					should_code_be_lowered1[],
-					const gchar *
-					variant_xpath_exprs[],
-					const gboolean
-					should_code_be_lowered2[])
+					func, gpointer data)
 {
-	xmlXPathObjectPtr xpath_obj;
-	xmlNodeSetPtr nodes;
-	const gchar **xpath_expr;
-	const gboolean *is_low_id = should_code_be_lowered1;
+	XklConfigIndex *index = xkl_config_registry_priv(config, index);
+	XklConfigItem *ci, *pci;
 	gchar *low_iso_code;
+	const gchar *names[] = { NULL, NULL };
+	guint i, pass;
 
-	if (!xkl_config_registry_is_initialized(config))
+	if (index == NULL)
 		return;
 
-	low_iso_code = g_ascii_strdown(iso_code, -1);
-
-	for (xpath_expr = layout_xpath_exprs; *xpath_expr;
-	     xpath_expr++, is_low_id++) {
-		const gchar *aic = *is_low_id ? low_iso_code : iso_code;
-		gchar *xpe = g_strdup_printf(*xpath_expr, aic);
-		gint di;
-		GSList *processed_ids = NULL;
-
-		for (di = 0; di < XKL_NUMBER_OF_REGISTRY_DOCS; di++) {
-			xmlXPathContextPtr xmlctxt =
-			    xkl_config_registry_priv(config,
-						     xpath_contexts[di]);
-			if (xmlctxt == NULL)
-				continue;
+	/* the layouts may be named after the countries */
+	low_iso_code = countries ? g_ascii_strdown(iso_code, -1) : NULL;
+	names[0] = low_iso_code;
 
-			xpath_obj =
-			    xmlXPathEval((unsigned char *) xpe, xmlctxt);
-			if (xpath_obj == NULL)
+	ci = xkl_config_item_new();
+	pci = xkl_config_item_new();
+
+	for (pass = 0; pass < G_N_ELEMENTS(names); pass++) {
+		if (pass == 0 && names[0] == NULL)
+			continue;
+		for (i = 0; i < index->layouts->len; i++) {
+			const XklConfigIndexItem *litem =
+			    xkl_config_index_item(index, layouts, i);
+			if (!xkl_config_iso_layout_matches
+			    (litem, countries, iso_code, names[pass]))
 				continue;
-
-			nodes = xpath_obj->nodesetval;
-			if (nodes != NULL) {
-				gint ni;
-				xmlNodePtr *node = nodes->nodeTab;
-				XklConfigItem *ci = xkl_config_item_new();
-				for (ni = nodes->nodeNr; --ni >= 0;) {
-					if (xkl_read_config_item
-					    (config, di, *node, ci)) {
-						if (g_slist_find_custom
-						    (processed_ids,
-						     ci->name,
-						     (GCompareFunc)
-						     g_ascii_strcasecmp) ==
-						    NULL) {
-							func(config, ci,
-							     NULL, data);
-							processed_ids =
-							    g_slist_append
-							    (processed_ids,
-							     g_strdup
-							     (ci->name));
-						}
-					}
-					node++;
-				}
-				g_object_unref(G_OBJECT(ci));
-			}
-			xmlXPathFreeObject(xpath_obj);
+			xkl_config_index_item_fill(litem, ci);
+			func(config, ci, NULL, data);
 		}
-		g_free(xpe);
 	}
 
-	is_low_id = should_code_be_lowered2;
-	for (xpath_expr = variant_xpath_exprs; *xpath_expr;
-	     xpath_expr++, is_low_id++) {
-		const gchar *aic = *is_low_id ? low_iso_code : iso_code;
-		gchar *xpe = g_strdup_printf(*xpath_expr, aic);
-		gint di;
-		for (di = 0; di < XKL_NUMBER_OF_REGISTRY_DOCS; di++) {
-			xmlXPathContextPtr xmlctxt =
-			    xkl_config_registry_priv(config,
-						     xpath_contexts[di]);
-			if (xmlctxt == NULL)
-				continue;
+	/* the variants listing the code themselves */
+	for (i = 0; i < index->variants->len; i++) {
+		const XklConfigIndexItem *vitem =
+		    xkl_config_index_item(index, variants, i);
+		if (!xkl_config_iso_list_contains(xkl_config_iso_list
+						  (vitem, countries),
+						  iso_code))
+			continue;
+		xkl_config_index_item_fill(xkl_config_index_item
+					   (index, layouts, vitem->parent),
+					   pci);
+		xkl_config_index_item_fill(vitem, ci);
+		func(config, pci, ci, data);
+	}
 
-			xpath_obj =
-			    xmlXPathEval((unsigned char *) xpe, xmlctxt);
-			if (xpath_obj == NULL)
+	/* the variants without a list of their own follow their layouts */
+	for (pass = 0; pass < G_N_ELEMENTS(names); pass++) {
+		if (pass == 0 && names[0] == NULL)
+			continue;
+		for (i = 0; i < index->variants->len; i++) {
+			const XklConfigIndexItem *vitem =
+			    xkl_config_index_item(index, variants, i);
+			const XklConfigIndexItem *litem =
+			    xkl_config_index_item(index, layouts,
+						  vitem->parent);
+			if (xkl_config_iso_list(vitem, countries) != NULL
+			    || !xkl_config_iso_layout_matches(litem,
+							      countries,
+							      iso_code,
+							      names
+							      [pass]))
 				continue;
-
-			nodes = xpath_obj->nodesetval;
-			if (nodes != NULL) {
-				gint ni;
-				xmlNodePtr *node = nodes->nodeTab;
-				XklConfigItem *ci = xkl_config_item_new();
-				XklConfigItem *pci = xkl_config_item_new();
-				for (ni = nodes->nodeNr; --ni >= 0;) {
-					if (xkl_read_config_item
-					    (config, di, *node, ci) &&
-					    xkl_read_config_item
-					    (config, di,
-					     (*node)->parent->parent, pci))
-						func(config, pci, ci,
-						     data);
-					node++;
-				}
-				g_object_unref(G_OBJECT(pci));
-				g_object_unref(G_OBJECT(ci));
-			}
-			xmlXPathFreeObject(xpath_obj);
+			xkl_config_index_item_fill(litem, pci);
+			xkl_config_index_item_fill(vitem, ci);
+			func(config, pci, ci, data);
 		}
-		g_free(xpe);
 	}
 
+	g_object_unref(G_OBJECT(pci));
+	g_object_unref(G_OBJECT(ci));
 	g_free(low_iso_code);
 }
 
@@ -443,33 +459,14 @@ xkl_config_registry_foreach_country_variant(XklConfigRegistry *
 					    XklTwoConfigItemsProcessFunc
 					    func, gpointer data)
 {
-	const gchar *layout_xpath_exprs[] = {
-		XKBCR_LAYOUT_PATH "[configItem/name = '%s']",
-		XKBCR_LAYOUT_PATH
-		    "[configItem/countryList/iso3166Id = '%s']",
-		NULL
-	};
-	const gboolean should_code_be_lowered1[] = { TRUE, FALSE };
-
-	const gchar *variant_xpath_exprs[] = {
-		XKBCR_VARIANT_PATH
-		    "[configItem/countryList/iso3166Id = '%s']",
-		XKBCR_VARIANT_PATH
-		    "[../../configItem/name = '%s' and not(configItem/countryList/iso3166Id)]",
-		XKBCR_VARIANT_PATH
-		    "[../../configItem/countryList/iso3166Id = '%s' and not(configItem/countryList/iso3166Id)]",
-		NULL
-	};
-
-	const gboolean should_code_be_lowered2[] = { FALSE, TRUE, FALSE };
-
-	xkl_config_registry_foreach_iso_variant(config,
-						country_code,
-						func, data,
-						layout_xpath_exprs,
-						should_code_be_lowered1,
-						variant_xpath_exprs,
-						should_code_be_lowered2);
+	gint64 start = g_get_monotonic_time();
+
+	xkl_config_registry_foreach_iso_variant(config, country_code, TRUE,
+						func, data);
+
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_FOREACH_COUNTRY_VARIANT,
+				     start);
 }
 
 void
@@ -480,27 +477,12 @@ xkl_config_registry_foreach_language_variant(XklConfigRegistry *
 					     XklTwoConfigItemsProcessFunc
 					     func, gpointer data)
 {
-	const gchar *layout_xpath_exprs[] = {
-		XKBCR_LAYOUT_PATH
-		    "[configItem/languageList/iso639Id = '%s']",
-		NULL
-	};
-	const gboolean should_code_be_lowered1[] = { FALSE };
-
-	const gchar *variant_xpath_exprs[] = {
-		XKBCR_VARIANT_PATH
-		    "[configItem/languageList/iso639Id = '%s']",
-		XKBCR_VARIANT_PATH
-		    "[../../configItem/languageList/iso639Id = '%s' and not(configItem/languageList/iso639Id)]",
-		NULL
-	};
-	const gboolean should_code_be_lowered2[] = { FALSE, FALSE };
-
-	xkl_config_registry_foreach_iso_variant(config,
-						language_code,
-						func, data,
-						layout_xpath_exprs,
-						should_code_be_lowered1,
-						variant_xpath_exprs,
-						should_code_be_lowered2);
+	gint64 start = g_get_monotonic_time();
+
+	xkl_config_registry_foreach_iso_variant(config, language_code,
+						FALSE, func, data);
+
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_FOREACH_LANGUAGE_VARIANT,
+				     start);
 }
@@ -0,0 +1,760 @@
+/*
+ * Copyright (C) 2002-2006 Sergey V. Udaltsov <svu@gnome.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+
+#include "config.h"
+
+#include "xklavier_private.h"
+
+#define xkl_config_search_text(search,id) \
+  ((search)->text->str + g_array_index((search)->text_offsets, guint, (id)))
+
+/* Returns the id of the text */
+static guint
+xkl_config_search_add_text(XklConfigSearchData * search,
+			   const gchar * text)
+{
+	guint offset = search->text->len;
+	gchar *utext = g_utf8_strup(text, -1);
+
+	/* keep the terminating NUL, the texts are scanned with strstr */
+	g_string_append_len(search->text, utext, strlen(utext) + 1);
+	g_free(utext);
+	g_array_append_val(search->text_offsets, offset);
+	return search->text_offsets->len - 1;
+}
+
+static guint
+xkl_config_search_add_name(XklConfigSearchData * search,
+			   const gchar * name)
+{
+	guint id;
+
+	if (name == NULL)
+		return 0;
+
+	id = xkl_config_search_add_text(search, name);
+	g_array_append_val(search->names, id);
+	return 1;
+}
+
+static void
+xkl_config_search_add_entry(XklConfigIndex * index,
+			    XklConfigSearchData * search,
+			    const XklConfigIndexItem * iitem,
+			    const gchar * description, gboolean check_name)
+{
+	XklConfigSearchEntry entry;
+	const gchar **code;
+
+	entry.description = xkl_config_search_add_text(search, description);
+	entry.first_name = search->names->len;
+	entry.n_countries = entry.n_languages = 0;
+
+	if (check_name) {
+		gchar *upper_name = g_ascii_strup(iitem->name, -1);
+		entry.n_countries +=
+		    xkl_config_search_add_name(search,
+					       xkl_config_index_get_country_name
+					       (index, upper_name));
+		g_free(upper_name);
+	}
+	for (code = iitem->countries; code != NULL && *code != NULL;
+	     code++)
+		entry.n_countries +=
+		    xkl_config_search_add_name(search,
+					       xkl_config_index_get_country_name
+					       (index, *code));
+
+	if (check_name)
+		entry.n_languages +=
+		    xkl_config_search_add_name(search,
+					       xkl_config_index_get_language_name
+					       (index, iitem->name));
+	for (code = iitem->languages; code != NULL && *code != NULL;
+	     code++)
+		entry.n_languages +=
+		    xkl_config_search_add_name(search,
+					       xkl_config_index_get_language_name
+					       (index, *code));
+
+	g_array_append_val(search->entries, entry);
+}
+
+/*
+ * Everything the search looks at, upper-cased once: descriptions of
+ * the layouts, "layout - variant" descriptions of the variants and the
+ * names of their countries and languages. Built on the first search,
+ * since the ISO names are not needed otherwise.
+ */
+static XklConfigSearchData *
+xkl_config_search_data_new(XklConfigIndex * index)
+{
+	XklConfigSearchData *search = g_new0(XklConfigSearchData, 1);
+	guint i;
+
+	search->text = g_string_sized_new(65536);
+	search->text_offsets = g_array_new(FALSE, FALSE, sizeof(guint));
+	search->names = g_array_new(FALSE, FALSE, sizeof(guint));
+	search->entries =
+	    g_array_sized_new(FALSE, FALSE, sizeof(XklConfigSearchEntry),
+			      index->layouts->len + index->variants->len);
+
+	for (i = 0; i < index->layouts->len; i++) {
+		const XklConfigIndexItem *iitem =
+		    xkl_config_index_item(index, layouts, i);
+		xkl_config_search_add_entry(index, search, iitem,
+					    iitem->description, TRUE);
+	}
+
+	for (i = 0; i < index->variants->len; i++) {
+		const XklConfigIndexItem *iitem =
+		    xkl_config_index_item(index, variants, i);
+		const XklConfigIndexItem *litem =
+		    xkl_config_index_item(index, layouts, iitem->parent);
+		gchar *full_desc = g_strdup_printf("%s - %s",
+						   litem->description,
+						   iitem->description);
+		xkl_config_search_add_entry(index, search, iitem,
+					    full_desc, FALSE);
+		g_free(full_desc);
+	}
+
+	xkl_debug(150, "Search data: %d bytes of text, %d names\n",
+		  search->text->len, search->names->len);
+	return search;
+}
+
+void
+xkl_config_search_data_free(XklConfigSearchData * search)
+{
+	if (search == NULL)
+		return;
+	g_string_free(search->text, TRUE);
+	g_array_free(search->text_offsets, TRUE);
+	g_array_free(search->names, TRUE);
+	g_array_free(search->entries, TRUE);
+	if (search->words != NULL) {
+		g_array_free(search->words, TRUE);
+		g_array_free(search->word_offsets, TRUE);
+		g_array_free(search->text_words, TRUE);
+		g_array_free(search->text_first_words, TRUE);
+	}
+	g_free(search);
+}
+
+static gboolean
+search_all(const XklConfigSearchData * search, guint id,
+	   const XklConfigSearchQuery * query)
+{
+	gchar **needles = query->needles;
+	const gchar *haystack;
+	guint n_words = 0, first_word = 0, k;
+
+	/* match anything */
+	if (!needles || !*needles)
+		return TRUE;
+
+	if (query->word_matches == NULL) {
+		haystack = xkl_config_search_text(search, id);
+		do {
+			if (strstr(haystack, *needles) == NULL)
+				return FALSE;
+			needles++;
+		} while (*needles);
+		return TRUE;
+	}
+
+	/* fuzzy: every needle is close enough to some word of the text */
+	first_word = g_array_index(search->text_first_words, guint, id);
+	n_words =
+	    g_array_index(search->text_first_words, guint,
+			  id + 1) - first_word;
+	for (k = 0; needles[k] != NULL; k++) {
+		const guint8 *word_matches =
+		    query->word_matches + k * search->word_offsets->len;
+		guint w;
+
+		for (w = 0; w < n_words; w++)
+			if (word_matches[g_array_index
+					 (search->text_words, guint,
+					  first_word + w)])
+				break;
+		if (w == n_words)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static gboolean
+search_any(const XklConfigSearchData * search, guint first, guint n,
+	   const XklConfigSearchQuery * query)
+{
+	for (; n > 0; n--, first++)
+		if (search_all(search,
+			       g_array_index(search->names, guint, first),
+			       query))
+			return TRUE;
+	return FALSE;
+}
+
+#define xkl_config_search_entry(search,i) \
+  (&g_array_index((search)->entries, XklConfigSearchEntry, (i)))
+
+/*
+ * Marks the matching layout and its matching variants in matches,
+ * which has a flag per search entry (layouts first, then variants)
+ */
+void
+xkl_config_search_layout(const XklConfigIndex * index, guint layout,
+			 const XklConfigSearchQuery * query,
+			 guint8 * matches)
+{
+	const XklConfigSearchData *search = index->search;
+	const XklConfigSearchEntry *entry =
+	    xkl_config_search_entry(search, layout);
+	const XklConfigIndexItem *litem =
+	    xkl_config_index_item(index, layouts, layout);
+	gboolean country_matched = FALSE, language_matched = FALSE;
+	gint i;
+
+	if (search_any(search, entry->first_name, entry->n_countries,
+		       query))
+		country_matched = TRUE;
+	else if (search_any(search,
+			    entry->first_name + entry->n_countries,
+			    entry->n_languages, query))
+		language_matched = TRUE;
+	else if (search_all(search, entry->description, query))
+		language_matched = TRUE;
+
+	matches[layout] = country_matched || language_matched;
+
+	for (i = litem->first_child; i >= 0;
+	     i = xkl_config_index_item(index, variants, i)->next_sibling) {
+		const XklConfigIndexItem *vitem =
+		    xkl_config_index_item(index, variants, i);
+		guint ei = index->layouts->len + i;
+		gboolean variant_matched;
+
+		entry = xkl_config_search_entry(search, ei);
+
+		variant_matched =
+		    search_all(search, entry->description, query);
+
+		/* variants without own lists take after the layout */
+		if (!variant_matched)
+			variant_matched =
+			    vitem->countries != NULL ?
+			    search_any(search, entry->first_name,
+				       entry->n_countries,
+				       query) : country_matched;
+
+		if (!variant_matched)
+			variant_matched =
+			    vitem->languages != NULL ?
+			    search_any(search,
+				       entry->first_name +
+				       entry->n_countries,
+				       entry->n_languages,
+				       query) : language_matched;
+
+		matches[ei] = variant_matched;
+	}
+}
+
+void
+xkl_config_search_deliver(XklConfigRegistry * config,
+			  const XklConfigIndex * index, guint layout,
+			  const guint8 * matches,
+			  XklConfigItem * layout_ci,
+			  XklConfigItem * variant_ci,
+			  XklTwoConfigItemsProcessFunc func, gpointer data)
+{
+	const XklConfigIndexItem *litem =
+	    xkl_config_index_item(index, layouts, layout);
+	gboolean layout_filled = FALSE;
+	gint i;
+
+	if (matches[layout]) {
+		xkl_config_index_item_fill(litem, layout_ci);
+		layout_filled = TRUE;
+		func(config, layout_ci, NULL, data);
+	}
+
+	for (i = litem->first_child; i >= 0;
+	     i = xkl_config_index_item(index, variants, i)->next_sibling) {
+		if (!matches[index->layouts->len + i])
+			continue;
+		if (!layout_filled) {
+			xkl_config_index_item_fill(litem, layout_ci);
+			layout_filled = TRUE;
+		}
+		xkl_config_index_item_fill(xkl_config_index_item
+					   (index, variants, i),
+					   variant_ci);
+		func(config, layout_ci, variant_ci, data);
+	}
+}
+
+XklConfigSearchData *
+xkl_config_index_get_search_data(XklConfigIndex * index)
+{
+	if (index->search == NULL)
+		index->search = xkl_config_search_data_new(index);
+	return index->search;
+}
+
+/* Layouts per task of the parallel search */
+#define XKL_SEARCH_CHUNK_SIZE 32
+
+typedef struct {
+	const XklConfigIndex *index;
+	const XklConfigSearchQuery *query;
+	guint8 *matches;
+
+	GMutex mutex;
+	GCond cond;
+	/* one flag per chunk of layouts */
+	guint8 *chunks_done;
+	struct _XklConfigSearchChunk *chunks;
+} XklConfigSearchJob;
+
+/* The pool is shared by the searches, every task knows its own */
+typedef struct _XklConfigSearchChunk {
+	XklConfigSearchJob *job;
+	guint chunk;
+} XklConfigSearchChunk;
+
+static void
+xkl_config_search_chunk(gpointer data, gpointer user_data)
+{
+	XklConfigSearchChunk *chunk = (XklConfigSearchChunk *) data;
+	XklConfigSearchJob *job = chunk->job;
+	guint c = chunk->chunk;
+	guint i = c * XKL_SEARCH_CHUNK_SIZE;
+	guint last = MIN(i + XKL_SEARCH_CHUNK_SIZE,
+			 job->index->layouts->len);
+
+	/* the flags of different layouts never overlap */
+	for (; i < last; i++)
+		xkl_config_search_layout(job->index, i, job->query,
+					 job->matches);
+
+	g_mutex_lock(&job->mutex);
+	job->chunks_done[c] = TRUE;
+	g_cond_broadcast(&job->cond);
+	g_mutex_unlock(&job->mutex);
+}
+
+/*
+ * Chunks of layouts are matched by the pool, the results are delivered
+ * here, chunk by chunk in the registry order, as soon as available
+ */
+static gboolean
+xkl_config_search_in_parallel(XklConfigRegistry * config,
+			      const XklConfigIndex * index,
+			      const XklConfigSearchQuery * query,
+			      guint8 * matches,
+			      gint n_threads, XklConfigItem * layout_ci,
+			      XklConfigItem * variant_ci,
+			      XklTwoConfigItemsProcessFunc func,
+			      gpointer data)
+{
+	XklConfigSearchJob job;
+	GThreadPool *pool = xkl_config_registry_priv(config, search_pool);
+	GError *error = NULL;
+	guint n_chunks =
+	    (index->layouts->len + XKL_SEARCH_CHUNK_SIZE -
+	     1) / XKL_SEARCH_CHUNK_SIZE;
+	guint c, i;
+
+	/*
+	 * The threads are started up front and kept, so a queued chunk
+	 * always has a thread to run it
+	 */
+	if (pool == NULL) {
+		pool = g_thread_pool_new(xkl_config_search_chunk, NULL,
+					 n_threads, TRUE, &error);
+		if (pool == NULL) {
+			xkl_debug(0, "Could not start search threads: %s\n",
+				  error->message);
+			g_error_free(error);
+			return FALSE;
+		}
+		xkl_config_registry_priv(config, search_pool) = pool;
+	} else if (g_thread_pool_get_max_threads(pool) != n_threads
+		   && !g_thread_pool_set_max_threads(pool, n_threads,
+						     &error)) {
+		/* the threads already there do the job */
+		xkl_debug(0, "Could not start more search threads: %s\n",
+			  error->message);
+		g_error_free(error);
+	}
+
+	job.index = index;
+	job.query = query;
+	job.matches = matches;
+	job.chunks_done = g_malloc0(n_chunks);
+	job.chunks = g_new(XklConfigSearchChunk, n_chunks);
+	g_mutex_init(&job.mutex);
+	g_cond_init(&job.cond);
+
+	/* FALSE only means no new thread, the chunk is queued anyway */
+	for (c = 0; c < n_chunks; c++) {
+		job.chunks[c].job = &job;
+		job.chunks[c].chunk = c;
+		g_thread_pool_push(pool, &job.chunks[c], NULL);
+	}
+
+	for (c = 0; c < n_chunks; c++) {
+		guint last = MIN((c + 1) * XKL_SEARCH_CHUNK_SIZE,
+				 index->layouts->len);
+
+		g_mutex_lock(&job.mutex);
+		while (!job.chunks_done[c])
+			g_cond_wait(&job.cond, &job.mutex);
+		g_mutex_unlock(&job.mutex);
+
+		for (i = c * XKL_SEARCH_CHUNK_SIZE; i < last; i++)
+			xkl_config_search_deliver(config, index, i,
+						  matches, layout_ci,
+						  variant_ci, func, data);
+	}
+
+	g_mutex_clear(&job.mutex);
+	g_cond_clear(&job.cond);
+	g_free(job.chunks);
+	g_free(job.chunks_done);
+	return TRUE;
+}
+
+static void
+xkl_config_search_run(XklConfigRegistry * config,
+		      const XklConfigIndex * index,
+		      const XklConfigSearchQuery * query,
+		      XklTwoConfigItemsProcessFunc func, gpointer data)
+{
+	guint8 *matches;
+	XklConfigItem *layout_ci, *variant_ci;
+	gint n_threads;
+	guint i;
+
+	matches = g_malloc0(index->layouts->len + index->variants->len);
+	layout_ci = xkl_config_item_new();
+	variant_ci = xkl_config_item_new();
+
+	n_threads = xkl_config_registry_priv(config, max_search_threads);
+	if (n_threads <= 0)
+		n_threads = g_get_num_processors();
+
+	if (n_threads == 1 || index->layouts->len <= XKL_SEARCH_CHUNK_SIZE
+	    || !xkl_config_search_in_parallel(config, index, query,
+					      matches, n_threads,
+					      layout_ci, variant_ci, func,
+					      data)) {
+		for (i = 0; i < index->layouts->len; i++) {
+			xkl_config_search_layout(index, i, query, matches);
+			xkl_config_search_deliver(config, index, i,
+						  matches, layout_ci,
+						  variant_ci, func, data);
+		}
+	}
+
+	g_object_unref(G_OBJECT(variant_ci));
+	g_object_unref(G_OBJECT(layout_ci));
+	g_free(matches);
+}
+
+void
+xkl_config_registry_search_by_pattern(XklConfigRegistry
+				      * config,
+				      const gchar *
+				      pattern,
+				      XklTwoConfigItemsProcessFunc
+				      func, gpointer data)
+{
+	XklConfigIndex *index = xkl_config_registry_priv(config, index);
+	XklConfigSearchQuery query = { NULL, NULL };
+	gint64 start = g_get_monotonic_time();
+	gchar *upattern;
+
+	xkl_debug(200, "Searching by pattern: [%s]\n", pattern);
+
+	if (index != NULL) {
+		xkl_config_index_get_search_data(index);
+
+		upattern = pattern ? g_utf8_strup(pattern, -1) : NULL;
+		query.needles =
+		    pattern ? g_strsplit(upattern, " ", -1) : NULL;
+
+		xkl_config_search_run(config, index, &query, func, data);
+
+		g_strfreev(query.needles);
+		g_free(upattern);
+	}
+
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_SEARCH_BY_PATTERN,
+				     start);
+}
+
+/* Splits upper-cased text into words, at anything but letters and digits */
+static gchar **
+xkl_config_search_split_words(const gchar * text)
+{
+	GPtrArray *words = g_ptr_array_new();
+	const gchar *start = NULL, *p;
+
+	for (p = text;; p = g_utf8_next_char(p)) {
+		gboolean alnum = *p != '\0'
+		    && g_unichar_isalnum(g_utf8_get_char(p));
+		if (alnum && start == NULL)
+			start = p;
+		else if (!alnum && start != NULL) {
+			g_ptr_array_add(words, g_strndup(start, p - start));
+			start = NULL;
+		}
+		if (*p == '\0')
+			break;
+	}
+	g_ptr_array_add(words, NULL);
+	return (gchar **) g_ptr_array_free(words, FALSE);
+}
+
+/*
+ * The vocabulary of the fuzzy search: distinct words of all the texts,
+ * as UCS-4 for the edit distance, and the words of every text.
+ * Built on the first fuzzy search.
+ */
+static void
+xkl_config_search_build_words(XklConfigSearchData * search)
+{
+	GHashTable *word_ids = g_hash_table_new_full(g_str_hash,
+						     g_str_equal, g_free,
+						     NULL);
+	guint id, n_texts = search->text_offsets->len;
+
+	search->words = g_array_new(FALSE, FALSE, sizeof(gunichar));
+	search->word_offsets = g_array_new(FALSE, FALSE, sizeof(guint));
+	search->text_words = g_array_new(FALSE, FALSE, sizeof(guint));
+	search->text_first_words =
+	    g_array_sized_new(FALSE, FALSE, sizeof(guint), n_texts + 1);
+
+	for (id = 0; id < n_texts; id++) {
+		gchar **words =
+		    xkl_config_search_split_words(xkl_config_search_text
+						  (search, id));
+		gchar **word;
+
+		g_array_append_val(search->text_first_words,
+				   search->text_words->len);
+
+		for (word = words; *word != NULL; word++) {
+			gpointer value;
+			guint word_id;
+
+			if (g_hash_table_lookup_extended
+			    (word_ids, *word, NULL, &value))
+				word_id = GPOINTER_TO_UINT(value);
+			else {
+				const gchar *p;
+				word_id = search->word_offsets->len;
+				g_array_append_val(search->word_offsets,
+						   search->words->len);
+				for (p = *word; *p != '\0';
+				     p = g_utf8_next_char(p)) {
+					gunichar c = g_utf8_get_char(p);
+					g_array_append_val(search->words, c);
+				}
+				g_hash_table_insert(word_ids,
+						    g_strdup(*word),
+						    GUINT_TO_POINTER
+						    (word_id));
+			}
+			g_array_append_val(search->text_words, word_id);
+		}
+		g_strfreev(words);
+	}
+	g_array_append_val(search->text_first_words,
+			   search->text_words->len);
+
+	xkl_debug(150, "Search vocabulary: %d words\n",
+		  g_hash_table_size(word_ids));
+	g_hash_table_destroy(word_ids);
+}
+
+#define xkl_config_search_word_length(search,w) \
+  (((w) + 1 < (search)->word_offsets->len ? \
+    g_array_index((search)->word_offsets, guint, (w) + 1) : \
+    (search)->words->len) - \
+   g_array_index((search)->word_offsets, guint, (w)))
+
+/*
+ * Whether the needle is within max_distance edits from some substring
+ * of the word (Sellers' variant of the Levenshtein distance).
+ * row is scratch space for length + 1 values.
+ */
+static gboolean
+xkl_config_search_word_is_close(const gunichar * needle, guint n,
+				const gunichar * word, guint length,
+				guint max_distance, guint * row)
+{
+	guint i, j;
+
+	/* a match may start anywhere in the word */
+	for (j = 0; j <= length; j++)
+		row[j] = 0;
+
+	for (i = 1; i <= n; i++) {
+		guint diagonal = row[0], row_min;
+
+		row[0] = row_min = i;
+		for (j = 1; j <= length; j++) {
+			guint above = row[j];
+			guint cost = diagonal + (needle[i - 1] != word[j - 1]);
+			cost = MIN(cost, above + 1);
+			cost = MIN(cost, row[j - 1] + 1);
+			row[j] = cost;
+			row_min = MIN(row_min, cost);
+			diagonal = above;
+		}
+		/* the distance only grows from here */
+		if (row_min > max_distance)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Short words get fewer edits, or every three-letter word would match
+ * every other one
+ */
+#define XKL_FUZZY_CHARS_PER_EDIT 4
+
+#define XKL_FUZZY_DEFAULT_DISTANCE 2
+
+static guint8 *
+xkl_config_search_match_words(const XklConfigSearchData * search,
+			       gchar ** needles, gint max_distance)
+{
+	guint n_words = search->word_offsets->len;
+	guint n_needles = g_strv_length(needles);
+	guint8 *word_matches = g_malloc0(n_needles * n_words);
+	guint max_length = 0, w, k;
+	guint *row;
+
+	for (w = 0; w < n_words; w++)
+		max_length =
+		    MAX(max_length,
+			xkl_config_search_word_length(search, w));
+	row = g_new(guint, max_length + 1);
+
+	for (k = 0; k < n_needles; k++) {
+		glong n;
+		gunichar *needle = g_utf8_to_ucs4_fast(needles[k], -1, &n);
+		guint distance =
+		    MIN((guint) max_distance,
+			n / XKL_FUZZY_CHARS_PER_EDIT);
+
+		for (w = 0; w < n_words; w++)
+			word_matches[k * n_words + w] =
+			    xkl_config_search_word_is_close(needle, n,
+							    &g_array_index
+							    (search->words,
+							     gunichar,
+							     g_array_index
+							     (search->word_offsets,
+							      guint, w)),
+							    xkl_config_search_word_length
+							    (search, w),
+							    distance, row);
+		g_free(needle);
+	}
+
+	g_free(row);
+	return word_matches;
+}
+
+void
+xkl_config_registry_search_fuzzy(XklConfigRegistry * config,
+				 const gchar * pattern,
+				 gint max_distance,
+				 XklTwoConfigItemsProcessFunc func,
+				 gpointer data)
+{
+	XklConfigIndex *index = xkl_config_registry_priv(config, index);
+	XklConfigSearchData *search;
+	XklConfigSearchQuery query = { NULL, NULL };
+	gchar *upattern;
+
+	gint64 start = g_get_monotonic_time();
+
+	xkl_debug(200, "Fuzzy search: [%s], max distance %d\n", pattern,
+		  max_distance);
+
+	if (index == NULL) {
+		xkl_config_registry_stat_add(config,
+					     XKL_CONFIG_REGISTRY_STAT_SEARCH_FUZZY,
+					     start);
+		return;
+	}
+
+	search = xkl_config_index_get_search_data(index);
+	if (search->words == NULL)
+		xkl_config_search_build_words(search);
+
+	if (max_distance < 0)
+		max_distance = XKL_FUZZY_DEFAULT_DISTANCE;
+
+	if (pattern != NULL) {
+		upattern = g_utf8_strup(pattern, -1);
+		query.needles = xkl_config_search_split_words(upattern);
+		g_free(upattern);
+		if (*query.needles != NULL)
+			query.word_matches =
+			    xkl_config_search_match_words(search,
+							  query.needles,
+							  max_distance);
+	}
+
+	xkl_config_search_run(config, index, &query, func, data);
+
+	g_free(query.word_matches);
+	g_strfreev(query.needles);
+
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_SEARCH_FUZZY,
+				     start);
+}
+
+void
+xkl_config_registry_set_max_search_threads(XklConfigRegistry * config,
+					   gint max_threads)
+{
+	xkl_config_registry_priv(config, max_search_threads) =
+	    MAX(max_threads, 0);
+}
+
+gint
+xkl_config_registry_get_max_search_threads(XklConfigRegistry * config)
+{
+	return xkl_config_registry_priv(config, max_search_threads);
+}
@@ -0,0 +1,927 @@
+/*
+ * Copyright (C) 2002-2006 Sergey V. Udaltsov <svu@gnome.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <locale.h>
+#include <libintl.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "config.h"
+
+#include "xklavier_private.h"
+
+/*
+ * The snapshot file:
+ *   header
+ *   strings: NUL-terminated, back to back, padded to 4 bytes
+ *   words: 32-bit, in the host byte order, strings given by offsets
+ *     locale the descriptions are translated for
+ *     files the snapshot is made of: the registry documents (no path
+ *       for the ones not read from files), the iso-codes, then the
+ *       message catalogs; path, size and modification time of every
+ *       file, all ones for the files which are not there
+ *     models, layouts, variants, option groups, options
+ *     country names, language names: code and name pairs
+ *     search data: texts, text offsets, names, entries
+ */
+#define XKL_SNAPSHOT_MAGIC "XKLSNAP"
+/* change on any change of the format */
+#define XKL_SNAPSHOT_VERSION 2
+#define XKL_SNAPSHOT_BYTE_ORDER 0x01020304
+/* no string, no item */
+#define XKL_SNAPSHOT_NONE G_MAXUINT32
+
+#define XKL_SNAPSHOT_WORDS_PER_ITEM 11
+#define XKL_SNAPSHOT_WORDS_PER_FILE 5
+
+typedef struct {
+	gchar magic[8];
+	guint32 version;
+	guint32 byte_order;
+	guint32 strings_size;
+	guint32 n_words;
+} XklSnapshotHeader;
+
+typedef struct {
+	GByteArray *strings;
+	/* string -> offset + 1 */
+	GHashTable *offsets;
+	GArray *words;
+} XklSnapshotWriter;
+
+typedef struct {
+	const gchar *strings;
+	guint32 strings_size;
+	const guchar *words;
+	guint32 n_words;
+	guint32 pos;
+	gboolean failed;
+} XklSnapshotReader;
+
+static const gchar *iso_codes_files[] = {
+	ISO_CODES_DATADIR "/iso_3166.xml",
+	ISO_CODES_DATADIR "/iso_639.xml"
+};
+
+/*
+ * What the messages are translated for: the messages locale, without
+ * the codeset, so that xkl-registry-compile and the session agree on it.
+ * NULL if LANGUAGE brings the translations of other locales in, one
+ * snapshot cannot cover the fallbacks of gettext.
+ */
+static gchar *
+xkl_snapshot_get_locale(void)
+{
+	const gchar *messages = setlocale(LC_MESSAGES, NULL);
+	const gchar *language;
+	gchar *locale, *codeset, *modifier;
+	gchar **variants, **languages, **lang, **variant;
+
+	/* no translations at all, LANGUAGE is not looked at */
+	if (messages == NULL || !strcmp(messages, "C")
+	    || !strcmp(messages, "POSIX"))
+		return g_strdup("C");
+
+	locale = g_strdup(messages);
+	codeset = strchr(locale, '.');
+	if (codeset != NULL) {
+		modifier = strchr(codeset, '@');
+		if (modifier == NULL)
+			*codeset = '\0';
+		else
+			memmove(codeset, modifier, strlen(modifier) + 1);
+	}
+
+	language = g_getenv("LANGUAGE");
+	if (language == NULL || *language == '\0')
+		return locale;
+
+	/* de_DE:de is fine for de_DE, en_US:en is not */
+	variants = g_get_locale_variants(locale);
+	languages = g_strsplit(language, ":", -1);
+	for (lang = languages; *lang != NULL; lang++) {
+		if (**lang == '\0')
+			continue;
+		for (variant = variants; *variant != NULL; variant++)
+			if (!strcmp(*lang, *variant))
+				break;
+		if (*variant == NULL) {
+			xkl_debug(100,
+				  "LANGUAGE %s goes beyond %s, no snapshot\n",
+				  language, locale);
+			g_free(locale);
+			locale = NULL;
+			break;
+		}
+	}
+	g_strfreev(languages);
+	g_strfreev(variants);
+	return locale;
+}
+
+gchar *
+xkl_config_registry_get_snapshot_name(const gchar * dir,
+				      const gchar * ruleset,
+				      gboolean if_extras_needed)
+{
+	gchar *locale = xkl_snapshot_get_locale();
+	gchar *snapshot_name;
+
+	if (locale == NULL)
+		return NULL;
+
+	snapshot_name = g_strdup_printf("%s/%s%s.%s.xklreg", dir, ruleset,
+					if_extras_needed ? ".extras" : "",
+					locale);
+	g_free(locale);
+	return snapshot_name;
+}
+
+static void
+xkl_snapshot_put(XklSnapshotWriter * writer, guint32 word)
+{
+	g_array_append_val(writer->words, word);
+}
+
+static void
+xkl_snapshot_put_string(XklSnapshotWriter * writer, const gchar * str)
+{
+	guint32 offset;
+
+	if (str == NULL) {
+		xkl_snapshot_put(writer, XKL_SNAPSHOT_NONE);
+		return;
+	}
+
+	offset =
+	    GPOINTER_TO_UINT(g_hash_table_lookup(writer->offsets, str));
+	if (offset == 0) {
+		offset = writer->strings->len + 1;
+		g_byte_array_append(writer->strings, (const guint8 *) str,
+				    strlen(str) + 1);
+		g_hash_table_insert(writer->offsets, g_strdup(str),
+				    GUINT_TO_POINTER(offset));
+	}
+	xkl_snapshot_put(writer, offset - 1);
+}
+
+static void
+xkl_snapshot_put_list(XklSnapshotWriter * writer, const gchar ** list)
+{
+	xkl_snapshot_put(writer,
+			 list == NULL ? 0 : g_strv_length((gchar **) list));
+	for (; list != NULL && *list != NULL; list++)
+		xkl_snapshot_put_string(writer, *list);
+}
+
+static void
+xkl_snapshot_put_uints(XklSnapshotWriter * writer, GArray * array)
+{
+	guint i;
+
+	xkl_snapshot_put(writer, array->len);
+	for (i = 0; i < array->len; i++)
+		xkl_snapshot_put(writer, g_array_index(array, guint, i));
+}
+
+static void
+xkl_snapshot_put_file(XklSnapshotWriter * writer, const gchar * file_name)
+{
+	struct stat stat_buf;
+
+	xkl_snapshot_put_string(writer, file_name);
+	if (file_name == NULL)
+		memset(&stat_buf, 0, sizeof stat_buf);
+	else if (stat(file_name, &stat_buf) != 0) {
+		/* must still be missing when the snapshot is loaded */
+		xkl_snapshot_put(writer, XKL_SNAPSHOT_NONE);
+		xkl_snapshot_put(writer, XKL_SNAPSHOT_NONE);
+		xkl_snapshot_put(writer, XKL_SNAPSHOT_NONE);
+		xkl_snapshot_put(writer, XKL_SNAPSHOT_NONE);
+		return;
+	}
+
+	xkl_snapshot_put(writer, (guint64) stat_buf.st_size >> 32);
+	xkl_snapshot_put(writer, (guint32) stat_buf.st_size);
+	xkl_snapshot_put(writer, (guint64) stat_buf.st_mtime >> 32);
+	xkl_snapshot_put(writer, (guint32) stat_buf.st_mtime);
+}
+
+static void
+xkl_snapshot_put_table(XklSnapshotWriter * writer, GArray * table)
+{
+	guint i;
+
+	xkl_snapshot_put(writer, table->len);
+	for (i = 0; i < table->len; i++) {
+		const XklConfigIndexItem *iitem =
+		    &g_array_index(table, XklConfigIndexItem, i);
+		xkl_snapshot_put_string(writer, iitem->name);
+		xkl_snapshot_put_string(writer, iitem->short_description);
+		xkl_snapshot_put_string(writer, iitem->description);
+		xkl_snapshot_put_string(writer, iitem->vendor);
+		xkl_snapshot_put_list(writer, iitem->countries);
+		xkl_snapshot_put_list(writer, iitem->languages);
+		xkl_snapshot_put(writer, (iitem->extra ? 1 : 0) |
+				 (iitem->allow_multiple_selection ? 2 : 0));
+		xkl_snapshot_put(writer, iitem->parent);
+		xkl_snapshot_put(writer, iitem->first_child);
+		xkl_snapshot_put(writer, iitem->last_child);
+		xkl_snapshot_put(writer, iitem->next_sibling);
+	}
+}
+
+static void
+xkl_snapshot_put_names(XklSnapshotWriter * writer, GHashTable * names)
+{
+	GHashTableIter iter;
+	gpointer code, name;
+
+	xkl_snapshot_put(writer, g_hash_table_size(names));
+	g_hash_table_iter_init(&iter, names);
+	while (g_hash_table_iter_next(&iter, &code, &name)) {
+		xkl_snapshot_put_string(writer, code);
+		xkl_snapshot_put_string(writer, name);
+	}
+}
+
+static void
+xkl_snapshot_put_search(XklSnapshotWriter * writer,
+			XklConfigSearchData * search)
+{
+	guint i;
+
+	/* the texts go as they are, NULs included */
+	xkl_snapshot_put(writer, writer->strings->len);
+	xkl_snapshot_put(writer, search->text->len);
+	g_byte_array_append(writer->strings,
+			    (const guint8 *) search->text->str,
+			    search->text->len);
+
+	xkl_snapshot_put_uints(writer, search->text_offsets);
+	xkl_snapshot_put_uints(writer, search->names);
+
+	xkl_snapshot_put(writer, search->entries->len);
+	for (i = 0; i < search->entries->len; i++) {
+		const XklConfigSearchEntry *entry =
+		    &g_array_index(search->entries, XklConfigSearchEntry,
+				   i);
+		xkl_snapshot_put(writer, entry->description);
+		xkl_snapshot_put(writer, entry->first_name);
+		xkl_snapshot_put(writer, entry->n_countries);
+		xkl_snapshot_put(writer, entry->n_languages);
+	}
+}
+
+static void
+xkl_snapshot_add_name(GHashTable * names, const gchar * code,
+		      const gchar * name)
+{
+	if (name != NULL)
+		g_hash_table_replace(names, g_strdup(code),
+				     g_strdup(name));
+}
+
+/* Both as listed and upper-cased, like the layout names are looked up */
+static void
+xkl_snapshot_add_country(XklConfigIndex * index, GHashTable * names,
+			 const gchar * code)
+{
+	gchar *upper_code = g_ascii_strup(code, -1);
+	xkl_snapshot_add_name(names, code,
+			      xkl_config_index_get_country_name(index,
+								code));
+	xkl_snapshot_add_name(names, upper_code,
+			      xkl_config_index_get_country_name(index,
+								upper_code));
+	g_free(upper_code);
+}
+
+/* The names of all the ISO codes the registry refers to */
+static void
+xkl_snapshot_add_item_names(XklConfigIndex * index,
+			    GHashTable * country_names,
+			    GHashTable * language_names, GArray * table,
+			    gboolean check_name)
+{
+	const gchar **code;
+	guint i;
+
+	for (i = 0; i < table->len; i++) {
+		const XklConfigIndexItem *iitem =
+		    &g_array_index(table, XklConfigIndexItem, i);
+		for (code = iitem->countries; code != NULL && *code != NULL;
+		     code++)
+			xkl_snapshot_add_country(index, country_names,
+						 *code);
+		for (code = iitem->languages; code != NULL && *code != NULL;
+		     code++)
+			xkl_snapshot_add_name(language_names, *code,
+					      xkl_config_index_get_language_name
+					      (index, *code));
+		if (!check_name)
+			continue;
+		xkl_snapshot_add_country(index, country_names, iitem->name);
+		xkl_snapshot_add_name(language_names, iitem->name,
+				      xkl_config_index_get_language_name
+				      (index, iitem->name));
+	}
+}
+
+/*
+ * The message catalogs the descriptions are translated with: for every
+ * domain, the ones gettext looks at for the locale, up to the first one
+ * which is there. A language pack installed or updated later makes the
+ * snapshot stale.
+ */
+static GPtrArray *
+xkl_snapshot_get_catalogs(const gchar * locale)
+{
+	const gchar *domains[] = { XKB_DOMAIN, "iso_3166", "iso_639" };
+	const gchar *dirs[G_N_ELEMENTS(domains)];
+	GPtrArray *catalogs = g_ptr_array_new_with_free_func(g_free);
+	const gchar *messages = setlocale(LC_MESSAGES, NULL);
+	gchar **variants, **name;
+	gchar *mo_name, *catalog;
+	guint i;
+
+	if (!strcmp(locale, "C"))
+		return catalogs;
+
+	dirs[0] = bindtextdomain(XKB_DOMAIN, NULL);
+	dirs[1] = dirs[2] = ISO_CODES_LOCALESDIR;
+
+	/* the full locale name goes first, with the codeset */
+	variants = g_get_locale_variants(locale);
+	for (i = 0; i < G_N_ELEMENTS(domains); i++) {
+		mo_name = g_strconcat(domains[i], ".mo", NULL);
+		catalog = NULL;
+		if (messages != NULL && strcmp(messages, locale)) {
+			catalog = g_build_filename(dirs[i], messages,
+						   "LC_MESSAGES", mo_name,
+						   NULL);
+			g_ptr_array_add(catalogs, catalog);
+		}
+		for (name = variants;
+		     *name != NULL
+		     && (catalog == NULL
+			 || !g_file_test(catalog, G_FILE_TEST_EXISTS));
+		     name++) {
+			catalog = g_build_filename(dirs[i], *name,
+						   "LC_MESSAGES", mo_name,
+						   NULL);
+			g_ptr_array_add(catalogs, catalog);
+		}
+		g_free(mo_name);
+	}
+	g_strfreev(variants);
+	return catalogs;
+}
+
+gboolean
+xkl_config_registry_save_snapshot(XklConfigRegistry * config,
+				  const gchar * file_name)
+{
+	XklConfigIndex *index = xkl_config_registry_priv(config, index);
+	XklSnapshotWriter writer;
+	XklSnapshotHeader header;
+	GHashTable *country_names, *language_names;
+	GPtrArray *catalogs;
+	GByteArray *contents;
+	GError *error = NULL;
+	gchar *locale;
+	gboolean rv;
+	guint i;
+
+	if (index == NULL) {
+		xkl_last_error_message = "No registry to save";
+		return FALSE;
+	}
+
+	locale = xkl_snapshot_get_locale();
+	if (locale == NULL) {
+		xkl_last_error_message =
+		    "The translations are not for a single locale";
+		return FALSE;
+	}
+
+	writer.strings = g_byte_array_sized_new(262144);
+	writer.offsets =
+	    g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	writer.words = g_array_sized_new(FALSE, FALSE, sizeof(guint32),
+					 65536);
+
+	xkl_snapshot_put_string(&writer, locale);
+	catalogs = xkl_snapshot_get_catalogs(locale);
+	g_free(locale);
+
+	xkl_snapshot_put(&writer, XKL_NUMBER_OF_REGISTRY_DOCS +
+			 G_N_ELEMENTS(iso_codes_files) + catalogs->len);
+	for (i = 0; i < XKL_NUMBER_OF_REGISTRY_DOCS; i++)
+		xkl_snapshot_put_file(&writer,
+				      xkl_config_registry_priv(config,
+							       doc_files
+							       [i]));
+	for (i = 0; i < G_N_ELEMENTS(iso_codes_files); i++)
+		xkl_snapshot_put_file(&writer, iso_codes_files[i]);
+	for (i = 0; i < catalogs->len; i++)
+		xkl_snapshot_put_file(&writer,
+				      g_ptr_array_index(catalogs, i));
+	g_ptr_array_free(catalogs, TRUE);
+
+	xkl_snapshot_put_table(&writer, index->models);
+	xkl_snapshot_put_table(&writer, index->layouts);
+	xkl_snapshot_put_table(&writer, index->variants);
+	xkl_snapshot_put_table(&writer, index->option_groups);
+	xkl_snapshot_put_table(&writer, index->options);
+
+	country_names = g_hash_table_new_full(g_str_hash, g_str_equal,
+					      g_free, g_free);
+	language_names = g_hash_table_new_full(g_str_hash, g_str_equal,
+					       g_free, g_free);
+	xkl_snapshot_add_item_names(index, country_names, language_names,
+				    index->layouts, TRUE);
+	xkl_snapshot_add_item_names(index, country_names, language_names,
+				    index->variants, FALSE);
+	xkl_snapshot_put_names(&writer, country_names);
+	xkl_snapshot_put_names(&writer, language_names);
+	g_hash_table_destroy(country_names);
+	g_hash_table_destroy(language_names);
+
+	xkl_snapshot_put_search(&writer,
+				xkl_config_index_get_search_data(index));
+
+	while (writer.strings->len % sizeof(guint32))
+		g_byte_array_append(writer.strings, (const guint8 *) "", 1);
+
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, XKL_SNAPSHOT_MAGIC, sizeof XKL_SNAPSHOT_MAGIC);
+	header.version = XKL_SNAPSHOT_VERSION;
+	header.byte_order = XKL_SNAPSHOT_BYTE_ORDER;
+	header.strings_size = writer.strings->len;
+	header.n_words = writer.words->len;
+
+	contents = g_byte_array_sized_new(sizeof header +
+					  writer.strings->len +
+					  writer.words->len *
+					  sizeof(guint32));
+	g_byte_array_append(contents, (const guint8 *) &header,
+			    sizeof header);
+	g_byte_array_append(contents, writer.strings->data,
+			    writer.strings->len);
+	g_byte_array_append(contents, (const guint8 *) writer.words->data,
+			    writer.words->len * sizeof(guint32));
+
+	g_byte_array_free(writer.strings, TRUE);
+	g_hash_table_destroy(writer.offsets);
+	g_array_free(writer.words, TRUE);
+
+	/* written aside and renamed, the readers never see half of it */
+	rv = g_file_set_contents(file_name, (const gchar *) contents->data,
+				 contents->len, &error);
+	if (rv)
+		xkl_debug(100, "Saved registry snapshot %s, %d bytes\n",
+			  file_name, contents->len);
+	else {
+		xkl_debug(0, "Could not save registry snapshot %s: %s\n",
+			  file_name, error->message);
+		xkl_last_error_message = "Could not save registry snapshot";
+		g_error_free(error);
+	}
+	g_byte_array_free(contents, TRUE);
+	return rv;
+}
+
+static guint32
+xkl_snapshot_get(XklSnapshotReader * reader)
+{
+	guint32 word;
+
+	if (reader->pos >= reader->n_words) {
+		reader->failed = TRUE;
+		return 0;
+	}
+	memcpy(&word, reader->words + reader->pos++ * sizeof word,
+	       sizeof word);
+	return word;
+}
+
+/* The number of the records to read, each of the given size */
+static guint32
+xkl_snapshot_get_count(XklSnapshotReader * reader, guint32 record_size)
+{
+	guint32 n = xkl_snapshot_get(reader);
+
+	if (n > (reader->n_words - reader->pos) / record_size) {
+		reader->failed = TRUE;
+		return 0;
+	}
+	return n;
+}
+
+static const gchar *
+xkl_snapshot_get_string(XklSnapshotReader * reader)
+{
+	guint32 offset = xkl_snapshot_get(reader);
+
+	if (offset == XKL_SNAPSHOT_NONE)
+		return NULL;
+	/* the strings are known to end with a NUL */
+	if (offset >= reader->strings_size) {
+		reader->failed = TRUE;
+		return "";
+	}
+	return reader->strings + offset;
+}
+
+static const gchar *
+xkl_snapshot_get_nonnull_string(XklSnapshotReader * reader)
+{
+	const gchar *str = xkl_snapshot_get_string(reader);
+
+	if (str == NULL) {
+		reader->failed = TRUE;
+		return "";
+	}
+	return str;
+}
+
+static const gchar **
+xkl_snapshot_get_list(XklSnapshotReader * reader, XklConfigIndex * index)
+{
+	guint32 i, n = xkl_snapshot_get_count(reader, 1);
+	const gchar **list;
+
+	if (n == 0)
+		return NULL;
+
+	list = g_new0(const gchar *, n + 1);
+	for (i = 0; i < n; i++)
+		list[i] = xkl_snapshot_get_nonnull_string(reader);
+	g_ptr_array_add(index->lists, list);
+	return list;
+}
+
+static gboolean
+xkl_snapshot_check_file(XklSnapshotReader * reader,
+			gboolean check_name, const gchar * expected_file_name)
+{
+	const gchar *file_name = xkl_snapshot_get_string(reader);
+	guint64 size, mtime;
+	struct stat stat_buf;
+
+	size = (guint64) xkl_snapshot_get(reader) << 32;
+	size |= xkl_snapshot_get(reader);
+	mtime = (guint64) xkl_snapshot_get(reader) << 32;
+	mtime |= xkl_snapshot_get(reader);
+
+	if (reader->failed)
+		return FALSE;
+
+	if (check_name && g_strcmp0(file_name, expected_file_name)) {
+		xkl_debug(100, "Registry snapshot is made of %s, not %s\n",
+			  file_name == NULL ? "(none)" : file_name,
+			  expected_file_name ==
+			  NULL ? "(none)" : expected_file_name);
+		return FALSE;
+	}
+
+	if (file_name == NULL)
+		return TRUE;
+
+	if (stat(file_name, &stat_buf) != 0) {
+		if (size == G_MAXUINT64 && mtime == G_MAXUINT64)
+			return TRUE;
+		xkl_debug(100, "Registry snapshot is made of %s, gone\n",
+			  file_name);
+		return FALSE;
+	}
+
+	if ((guint64) stat_buf.st_size != size
+	    || (guint64) stat_buf.st_mtime != mtime) {
+		xkl_debug(100, "Registry snapshot is older than %s\n",
+			  file_name);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static gboolean
+xkl_snapshot_check_files(XklSnapshotReader * reader,
+			 const gchar * doc_files[])
+{
+	guint32 i, n =
+	    xkl_snapshot_get_count(reader, XKL_SNAPSHOT_WORDS_PER_FILE);
+
+	if (n < XKL_NUMBER_OF_REGISTRY_DOCS)
+		return FALSE;
+
+	for (i = 0; i < n; i++) {
+		gboolean is_doc = doc_files != NULL
+		    && i < XKL_NUMBER_OF_REGISTRY_DOCS;
+		if (!xkl_snapshot_check_file
+		    (reader, is_doc, is_doc ? doc_files[i] : NULL))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+xkl_snapshot_get_table(XklSnapshotReader * reader, XklConfigIndex * index,
+		       GArray * table)
+{
+	guint32 i, n =
+	    xkl_snapshot_get_count(reader, XKL_SNAPSHOT_WORDS_PER_ITEM);
+	XklConfigIndexItem iitem;
+	guint32 flags;
+
+	for (i = 0; i < n && !reader->failed; i++) {
+		iitem.name = xkl_snapshot_get_nonnull_string(reader);
+		iitem.short_description =
+		    xkl_snapshot_get_nonnull_string(reader);
+		iitem.description = xkl_snapshot_get_nonnull_string(reader);
+		iitem.vendor = xkl_snapshot_get_string(reader);
+		iitem.countries = xkl_snapshot_get_list(reader, index);
+		iitem.languages = xkl_snapshot_get_list(reader, index);
+		flags = xkl_snapshot_get(reader);
+		iitem.extra = (flags & 1) != 0;
+		iitem.allow_multiple_selection = (flags & 2) != 0;
+		iitem.parent = (gint32) xkl_snapshot_get(reader);
+		iitem.first_child = (gint32) xkl_snapshot_get(reader);
+		iitem.last_child = (gint32) xkl_snapshot_get(reader);
+		iitem.next_sibling = (gint32) xkl_snapshot_get(reader);
+		g_array_append_val(table, iitem);
+	}
+}
+
+static gboolean
+xkl_snapshot_link_is_valid(gint link, GArray * table)
+{
+	if (table == NULL)
+		return link == -1;
+	return link >= -1 && link < (gint) table->len;
+}
+
+/*
+ * Every link points into the table it should, or nowhere.
+ * No children table means no children at all.
+ */
+static gboolean
+xkl_snapshot_check_links(GArray * parents, GArray * children)
+{
+	guint i;
+
+	for (i = 0; i < parents->len; i++) {
+		const XklConfigIndexItem *iitem =
+		    &g_array_index(parents, XklConfigIndexItem, i);
+		if (iitem->parent != -1 || iitem->next_sibling != -1
+		    || !xkl_snapshot_link_is_valid(iitem->first_child,
+						   children)
+		    || !xkl_snapshot_link_is_valid(iitem->last_child,
+						   children))
+			return FALSE;
+	}
+	for (i = 0; children != NULL && i < children->len; i++) {
+		const XklConfigIndexItem *iitem =
+		    &g_array_index(children, XklConfigIndexItem, i);
+		if (iitem->parent < 0 || iitem->parent >= (gint) parents->len
+		    || iitem->first_child != -1 || iitem->last_child != -1
+		    || !xkl_snapshot_link_is_valid(iitem->next_sibling,
+						   children))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static GHashTable *
+xkl_snapshot_get_names(XklSnapshotReader * reader)
+{
+	GHashTable *names = g_hash_table_new(g_str_hash, g_str_equal);
+	guint32 i, n = xkl_snapshot_get_count(reader, 2);
+
+	for (i = 0; i < n; i++) {
+		const gchar *code = xkl_snapshot_get_nonnull_string(reader);
+		const gchar *name = xkl_snapshot_get_nonnull_string(reader);
+		g_hash_table_insert(names, (gpointer) code, (gpointer) name);
+	}
+	return names;
+}
+
+static GArray *
+xkl_snapshot_get_uints(XklSnapshotReader * reader, guint limit)
+{
+	guint32 i, n = xkl_snapshot_get_count(reader, 1);
+	GArray *array = g_array_sized_new(FALSE, FALSE, sizeof(guint), n);
+
+	for (i = 0; i < n; i++) {
+		guint value = xkl_snapshot_get(reader);
+		if (value >= limit)
+			reader->failed = TRUE;
+		g_array_append_val(array, value);
+	}
+	return array;
+}
+
+static XklConfigSearchData *
+xkl_snapshot_get_search(XklSnapshotReader * reader,
+			XklConfigIndex * index)
+{
+	XklConfigSearchData *search = g_new0(XklConfigSearchData, 1);
+	guint32 text_offset, text_size, i, n;
+	guint n_texts;
+
+	text_offset = xkl_snapshot_get(reader);
+	text_size = xkl_snapshot_get(reader);
+	if (text_offset > reader->strings_size
+	    || text_size > reader->strings_size - text_offset
+	    || (text_size > 0
+		&& reader->strings[text_offset + text_size - 1] != '\0')) {
+		reader->failed = TRUE;
+		text_size = 0;
+	}
+	search->text =
+	    g_string_new_len(reader->strings + text_offset, text_size);
+
+	search->text_offsets = xkl_snapshot_get_uints(reader, text_size);
+	n_texts = search->text_offsets->len;
+	search->names = xkl_snapshot_get_uints(reader, n_texts);
+
+	n = xkl_snapshot_get_count(reader, 4);
+	if (n != index->layouts->len + index->variants->len)
+		reader->failed = TRUE;
+	search->entries =
+	    g_array_sized_new(FALSE, FALSE, sizeof(XklConfigSearchEntry),
+			      n);
+	for (i = 0; i < n && !reader->failed; i++) {
+		XklConfigSearchEntry entry;
+		entry.description = xkl_snapshot_get(reader);
+		entry.first_name = xkl_snapshot_get(reader);
+		entry.n_countries = xkl_snapshot_get(reader);
+		entry.n_languages = xkl_snapshot_get(reader);
+		if (entry.description >= n_texts
+		    || entry.first_name > search->names->len
+		    || entry.n_countries >
+		    search->names->len - entry.first_name
+		    || entry.n_languages >
+		    search->names->len - entry.first_name -
+		    entry.n_countries)
+			reader->failed = TRUE;
+		g_array_append_val(search->entries, entry);
+	}
+	return search;
+}
+
+static XklConfigIndex *
+xkl_snapshot_read(XklSnapshotReader * reader, const gchar * file_name,
+		  const gchar * doc_files[])
+{
+	XklConfigIndex *index;
+	const gchar *snapshot_locale;
+	gchar *locale = xkl_snapshot_get_locale();
+	guint di;
+
+	snapshot_locale = xkl_snapshot_get_string(reader);
+	if (locale == NULL || snapshot_locale == NULL
+	    || strcmp(snapshot_locale, locale)) {
+		xkl_debug(100, "Registry snapshot %s is not for %s\n",
+			  file_name, locale != NULL ? locale : "LANGUAGE");
+		g_free(locale);
+		return NULL;
+	}
+	g_free(locale);
+
+	if (!xkl_snapshot_check_files(reader, doc_files))
+		return NULL;
+
+	index = xkl_config_index_new_empty();
+	xkl_snapshot_get_table(reader, index, index->models);
+	xkl_snapshot_get_table(reader, index, index->layouts);
+	xkl_snapshot_get_table(reader, index, index->variants);
+	xkl_snapshot_get_table(reader, index, index->option_groups);
+	xkl_snapshot_get_table(reader, index, index->options);
+	index->country_names = xkl_snapshot_get_names(reader);
+	index->language_names = xkl_snapshot_get_names(reader);
+	if (!reader->failed)
+		index->search = xkl_snapshot_get_search(reader, index);
+
+	if (reader->failed || reader->pos != reader->n_words
+	    || !xkl_snapshot_check_links(index->models, NULL)
+	    || !xkl_snapshot_check_links(index->layouts, index->variants)
+	    || !xkl_snapshot_check_links(index->option_groups,
+					 index->options)) {
+		xkl_debug(0, "Broken registry snapshot %s\n", file_name);
+		xkl_config_index_free(index);
+		return NULL;
+	}
+
+	/* the names of the layouts and groups are unique */
+	for (di = 0; di < index->layouts->len; di++)
+		g_hash_table_insert(index->layouts_by_name, (gpointer)
+				    xkl_config_index_item(index, layouts,
+							  di)->name,
+				    GINT_TO_POINTER(di + 1));
+	for (di = 0; di < index->option_groups->len; di++)
+		g_hash_table_insert(index->option_groups_by_name, (gpointer)
+				    xkl_config_index_item(index,
+							  option_groups,
+							  di)->name,
+				    GINT_TO_POINTER(di + 1));
+	return index;
+}
+
+static XklConfigIndex *
+xkl_snapshot_map(const gchar * file_name, const gchar * doc_files[])
+{
+	XklSnapshotHeader header;
+	XklSnapshotReader reader;
+	XklConfigIndex *index = NULL;
+	GMappedFile *mapped;
+	GError *error = NULL;
+	const gchar *contents;
+	gsize size;
+
+	xkl_last_error_message = "No valid registry snapshot";
+
+	mapped = g_mapped_file_new(file_name, FALSE, &error);
+	if (mapped == NULL) {
+		xkl_debug(100, "No registry snapshot %s: %s\n", file_name,
+			  error->message);
+		g_error_free(error);
+		return NULL;
+	}
+
+	contents = g_mapped_file_get_contents(mapped);
+	size = g_mapped_file_get_length(mapped);
+	if (size >= sizeof header)
+		memcpy(&header, contents, sizeof header);
+
+	if (size < sizeof header
+	    || memcmp(header.magic, XKL_SNAPSHOT_MAGIC,
+		      sizeof XKL_SNAPSHOT_MAGIC)
+	    || header.version != XKL_SNAPSHOT_VERSION
+	    || header.byte_order != XKL_SNAPSHOT_BYTE_ORDER
+	    || header.strings_size == 0
+	    || (guint64) size != sizeof header + (guint64)
+	    header.strings_size +
+	    (guint64) header.n_words * sizeof(guint32)
+	    || contents[sizeof header + header.strings_size - 1] != '\0') {
+		xkl_debug(0, "Unknown registry snapshot format in %s\n",
+			  file_name);
+	} else {
+		reader.strings = contents + sizeof header;
+		reader.strings_size = header.strings_size;
+		reader.words = (const guchar *) reader.strings +
+		    header.strings_size;
+		reader.n_words = header.n_words;
+		reader.pos = 0;
+		reader.failed = FALSE;
+		index = xkl_snapshot_read(&reader, file_name, doc_files);
+	}
+
+	if (index == NULL)
+		g_mapped_file_unref(mapped);
+	else
+		index->snapshot = mapped;
+	return index;
+}
+
+/*
+ * Takes the snapshot if it is for the current locale and neither the
+ * files it is made of nor the iso-codes have changed since. If doc_files
+ * is not NULL, the snapshot must be made of exactly these files.
+ */
+gboolean
+xkl_config_registry_load_snapshot_for(XklConfigRegistry * config,
+				      const gchar * file_name,
+				      const gchar * doc_files[])
+{
+	gint64 start = g_get_monotonic_time();
+	XklConfigIndex *index = xkl_snapshot_map(file_name, doc_files);
+
+	if (index != NULL) {
+		xkl_config_registry_priv(config, index) = index;
+		xkl_debug(100, "Loaded registry snapshot %s\n",
+			  file_name);
+	}
+
+	xkl_config_registry_stat_add(config,
+				     XKL_CONFIG_REGISTRY_STAT_LOAD_SNAPSHOT,
+				     start);
+	return index != NULL;
+}
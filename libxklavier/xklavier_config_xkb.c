@@ -24,10 +24,13 @@
 #include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <utime.h>
 
 #include <sys/types.h>
 #include <fcntl.h>
 
+#include <glib-unix.h>
 #include <libxml/xpath.h>
 
 #include "config.h"
@@ -38,6 +41,7 @@
 #ifdef LIBXKBFILE_PRESENT
 #include <X11/extensions/XKBfile.h>
 #include <X11/extensions/XKM.h>
+#include <X11/extensions/XKBgeom.h>
 #endif
 
 #define XKBCOMP ( XKB_BIN_BASE "/xkbcomp" )
@@ -46,43 +50,98 @@
 #include <X11/keysymdef.h>
 
 #ifdef LIBXKBFILE_PRESENT
-static XkbRF_RulesPtr xkl_rules;
+/*
+ * The parsed rules, per ruleset and locale, until the rules file changes.
+ * XkbRF_GetComponents() marks the matching rules inside the rules set,
+ * so the lock is held for as long as the rules set is used.
+ */
+typedef struct {
+	XkbRF_RulesPtr rules;
+	time_t mtime;
+	off_t size;
+} XklRulesCacheEntry;
+
+static GHashTable *xkl_rules_cache;
+static GMutex xkl_rules_cache_mutex;
+
+static void
+xkl_rules_cache_entry_free(XklRulesCacheEntry * entry)
+{
+	XkbRF_Free(entry->rules, True);
+	g_free(entry);
+}
 
+/*
+ * The rules cache has to be locked. Used from several threads, so the
+ * failures are only logged, the caller knows what to report.
+ */
 static XkbRF_RulesPtr
-xkl_rules_set_load(XklEngine * engine)
+xkl_rules_set_get(const gchar * rf)
 {
-	XkbRF_RulesPtr rules_set = NULL;
+	XklRulesCacheEntry *entry;
+	XkbRF_RulesPtr rules_set;
+	struct stat stat_buf;
 	char file_name[MAXPATHLEN] = "";
-	char *rf =
-	    xkl_engine_get_ruleset_name(engine, XKB_DEFAULT_RULESET);
 	char *locale = NULL;
+	gchar *key;
 
 	if (rf == NULL) {
-		xkl_last_error_message =
-		    "Could not find the XKB rules set";
+		xkl_debug(0, "Could not find the XKB rules set\n");
 		return NULL;
 	}
 
 	locale = setlocale(LC_ALL, NULL);
 
 	g_snprintf(file_name, sizeof file_name, XKB_BASE "/rules/%s", rf);
+
+	if (stat(file_name, &stat_buf) != 0) {
+		xkl_debug(0, "Could not stat rules [%s]: %s\n", file_name,
+			  g_strerror(errno));
+		return NULL;
+	}
+
+	if (xkl_rules_cache == NULL)
+		xkl_rules_cache =
+		    g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+					  (GDestroyNotify)
+					  xkl_rules_cache_entry_free);
+
+	key = g_strconcat(rf, "\n", locale != NULL ? locale : "", NULL);
+	entry = g_hash_table_lookup(xkl_rules_cache, key);
+	if (entry != NULL && entry->mtime == stat_buf.st_mtime
+	    && entry->size == stat_buf.st_size) {
+		xkl_debug(160, "Reusing the rules from [%s]\n", file_name);
+		g_free(key);
+		return entry->rules;
+	}
+
 	xkl_debug(160, "Loading rules from [%s]\n", file_name);
 
 	rules_set = XkbRF_Load(file_name, locale, True, True);
 
 	if (rules_set == NULL) {
-		xkl_last_error_message = "Could not load rules";
+		xkl_debug(0, "Could not load rules [%s]\n", file_name);
+		g_hash_table_remove(xkl_rules_cache, key);
+		g_free(key);
 		return NULL;
 	}
+
+	entry = g_new(XklRulesCacheEntry, 1);
+	entry->rules = rules_set;
+	entry->mtime = stat_buf.st_mtime;
+	entry->size = stat_buf.st_size;
+	g_hash_table_replace(xkl_rules_cache, key, entry);
 	return rules_set;
 }
 
-static void
-xkl_rules_set_free(void)
+void
+xkl_xkb_rules_cache_free(void)
 {
-	if (xkl_rules)
-		XkbRF_Free(xkl_rules, True);
-	xkl_rules = NULL;
+	g_mutex_lock(&xkl_rules_cache_mutex);
+	if (xkl_rules_cache != NULL)
+		g_hash_table_destroy(xkl_rules_cache);
+	xkl_rules_cache = NULL;
+	g_mutex_unlock(&xkl_rules_cache_mutex);
 }
 #endif
 
@@ -105,19 +164,42 @@ xkl_xkb_load_config_registry(XklConfigRegistry * config,
 }
 
 #ifdef LIBXKBFILE_PRESENT
-gboolean
-xkl_xkb_config_native_prepare(XklEngine * engine,
-			      const XklConfigRec * data,
-			      XkbComponentNamesPtr component_names_ptr)
+/* What to report for the configuration which is not valid */
+static const gchar *
+xkl_xkb_config_validity_message(XklConfigRecValidity validity)
+{
+	switch (validity) {
+	case XKL_CONFIG_REC_NO_RULES:
+		return "Could not load rules";
+	case XKL_CONFIG_REC_NOT_RESOLVED:
+		return "Could not translate rules into components";
+	case XKL_CONFIG_REC_NOT_COMPILED:
+		return "Could not compile the keymap";
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * Resolves the configuration into the keymap components through the
+ * given rules set, no X involved. Returns the validity of the config,
+ * the last error message is left alone: any thread can call it.
+ */
+static XklConfigRecValidity
+xkl_xkb_config_resolve(const gchar * rf, const XklConfigRec * data,
+		       XkbComponentNamesPtr component_names_ptr)
 {
 	XkbRF_VarDefsRec xkl_var_defs;
+	XkbRF_RulesPtr rules_set;
 	gboolean got_components;
 
 	memset(&xkl_var_defs, 0, sizeof(xkl_var_defs));
 
-	xkl_rules = xkl_rules_set_load(engine);
-	if (!xkl_rules) {
-		return FALSE;
+	g_mutex_lock(&xkl_rules_cache_mutex);
+	rules_set = xkl_rules_set_get(rf);
+	if (!rules_set) {
+		g_mutex_unlock(&xkl_rules_cache_mutex);
+		return XKL_CONFIG_REC_NO_RULES;
 	}
 
 	xkl_var_defs.model = (char *) data->model;
@@ -132,20 +214,19 @@ xkl_xkb_config_native_prepare(XklEngine * engine,
 		xkl_var_defs.options = xkl_config_rec_merge_options(data);
 
 	got_components =
-	    XkbRF_GetComponents(xkl_rules, &xkl_var_defs,
+	    XkbRF_GetComponents(rules_set, &xkl_var_defs,
 				component_names_ptr);
+	g_mutex_unlock(&xkl_rules_cache_mutex);
 
 	g_free(xkl_var_defs.layout);
 	g_free(xkl_var_defs.variant);
 	g_free(xkl_var_defs.options);
 
 	if (!got_components) {
-		xkl_last_error_message =
-		    "Could not translate rules into components";
 		/* Just cleanup the stuff in case of failure */
-		xkl_xkb_config_native_cleanup(engine, component_names_ptr);
+		xkl_xkb_config_native_cleanup(NULL, component_names_ptr);
 
-		return FALSE;
+		return XKL_CONFIG_REC_NOT_RESOLVED;
 	}
 
 	if (xkl_debug_level >= 200) {
@@ -161,15 +242,38 @@ xkl_xkb_config_native_prepare(XklEngine * engine,
 		xkl_debug(200, "geometry: %s\n",
 			  component_names_ptr->geometry);
 	}
-	return TRUE;
+	return XKL_CONFIG_REC_VALID;
+}
+
+static XklConfigRecValidity
+xkl_xkb_config_resolve_for_engine(XklEngine * engine,
+				  const XklConfigRec * data,
+				  XkbComponentNamesPtr component_names_ptr)
+{
+	return xkl_xkb_config_resolve(xkl_engine_get_ruleset_name
+				      (engine, XKB_DEFAULT_RULESET), data,
+				      component_names_ptr);
+}
+
+gboolean
+xkl_xkb_config_native_prepare(XklEngine * engine,
+			      const XklConfigRec * data,
+			      XkbComponentNamesPtr component_names_ptr)
+{
+	XklConfigRecValidity validity =
+	    xkl_xkb_config_resolve_for_engine(engine, data,
+					      component_names_ptr);
+
+	if (validity == XKL_CONFIG_REC_VALID)
+		return TRUE;
+	xkl_last_error_message = xkl_xkb_config_validity_message(validity);
+	return FALSE;
 }
 
 void
 xkl_xkb_config_native_cleanup(XklEngine * engine,
 			      XkbComponentNamesPtr component_names_ptr)
 {
-	xkl_rules_set_free();
-
 	g_free(component_names_ptr->keymap);
 	g_free(component_names_ptr->keycodes);
 	g_free(component_names_ptr->compat);
@@ -196,30 +300,39 @@ xkl_config_get_current_group_description(XklEngine * engine)
 			[group]);
 }
 
+/*
+ * The group names are taken from the keymap just sent to the server,
+ * the cached info is refreshed later, on XkbNewKeyboardNotify.
+ * The lock is flushed by the caller.
+ */
 static void
-xkl_config_set_group_by_description(XklEngine * engine, gchar * descr)
+xkl_config_set_group_by_description(XklEngine * engine, XkbDescPtr xkb,
+				    gchar * descr)
 {
-	int group, n_groups;
-	gchar **group_names;
+	const gchar *group_names[XkbNumKbdGroups];
+	int group, n_groups = 0;
 
 	if (descr == NULL)
 		return;
 
-	// perhaps could be made mode lightweight?
-	xkl_engine_reset_all_info(engine, FALSE,
-				  "Direct reload on activation");
+	if (xkb != NULL && xkb->names != NULL)
+		while (n_groups < XkbNumKbdGroups
+		       && xkb->names->groups[n_groups] != None)
+			n_groups++;
 
-	n_groups =
-	    xkl_engine_backend(engine, XklXkb,
-			       cached_desc)->ctrls->num_groups;
-	group_names = xkl_engine_backend(engine, XklXkb, group_names);
+	if (n_groups > 0)
+		xkl_xkb_get_atom_names(engine, xkb->names->groups, n_groups,
+				       group_names);
 
-	for (group = 0; group < n_groups; group++, group_names++) {
-		if (!g_ascii_strcasecmp(descr, *group_names)) {
+	for (group = 0; group < n_groups; group++) {
+		if (group_names[group] != NULL
+		    && !g_ascii_strcasecmp(descr, group_names[group])) {
 			xkl_debug(150,
 				  "Found the group with the same description, %d: [%s]\n",
-				  group, *group_names);
-			xkl_engine_lock_group(engine, group);
+				  group, group_names[group]);
+			XkbLockGroup(xkb->dpy,
+				     xkl_engine_backend(engine, XklXkb,
+							device_id), group);
 			break;
 		}
 	}
@@ -227,210 +340,869 @@ xkl_config_set_group_by_description(XklEngine * engine, gchar * descr)
 	g_free(descr);
 }
 
-static XkbDescPtr
-xkl_config_get_keyboard(XklEngine * engine,
-			XkbComponentNamesPtr component_names_ptr,
-			gboolean activate)
+/*
+ * Compiled keymaps are kept in the user cache directory, named after
+ * a hash of the keymap source and of the stamps of xkbcomp and the XKB
+ * data directories. The directory mtimes only change when the files are
+ * added or replaced, which is what the packages do on update.
+ */
+#define XKL_XKM_CACHE_MAX_SIZE ( 8 * 1024 * 1024 )
+
+/* Background compilation: one xkbcomp at a time, niced, few waiting */
+#define XKL_PRECOMPILE_MAX_THREADS 1
+#define XKL_PRECOMPILE_MAX_PENDING 8
+#define XKL_PRECOMPILE_NICE 10
+
+static const gchar *xkl_xkm_cache_stamped_paths[] = {
+	XKBCOMP,
+	XKB_BASE,
+	XKB_BASE "/keycodes",
+	XKB_BASE "/types",
+	XKB_BASE "/compat",
+	XKB_BASE "/symbols",
+	XKB_BASE "/geometry"
+};
+
+static gchar *
+xkl_xkm_cache_get_dir(void)
 {
-	XkbDescPtr xkb = NULL;
+	return g_build_filename(g_get_user_cache_dir(), "libxklavier",
+				"xkm", NULL);
+}
 
-	char xkm_fn[L_tmpnam];
-	char xkb_fn[L_tmpnam];
-	FILE *tmpxkm;
-	XkbFileInfo result;
+static gchar *
+xkl_xkm_cache_get_file_name(const gchar * keymap)
+{
+	GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+	struct stat stat_buf;
+	gchar *dir, *base_name, *file_name;
+	guint i;
+
+	g_checksum_update(checksum, (const guchar *) keymap, -1);
+	for (i = 0; i < G_N_ELEMENTS(xkl_xkm_cache_stamped_paths); i++) {
+		gint64 stamp[2] = { 0, 0 };
+		if (stat(xkl_xkm_cache_stamped_paths[i], &stat_buf) == 0) {
+			stamp[0] = stat_buf.st_mtime;
+			stamp[1] = stat_buf.st_size;
+		}
+		g_checksum_update(checksum, (const guchar *) stamp,
+				  sizeof stamp);
+	}
+
+	dir = xkl_xkm_cache_get_dir();
+	base_name =
+	    g_strconcat(g_checksum_get_string(checksum), ".xkm", NULL);
+	file_name = g_build_filename(dir, base_name, NULL);
+	g_free(base_name);
+	g_free(dir);
+	g_checksum_free(checksum);
+	return file_name;
+}
+
+typedef struct {
+	gchar *file_name;
+	time_t mtime;
+	off_t size;
+} XklXkmCacheFile;
+
+static gint
+xkl_xkm_cache_file_compare(gconstpointer a, gconstpointer b)
+{
+	const XklXkmCacheFile *fa = *(XklXkmCacheFile * const *) a;
+	const XklXkmCacheFile *fb = *(XklXkmCacheFile * const *) b;
+	return fa->mtime < fb->mtime ? -1 : fa->mtime > fb->mtime;
+}
+
+static void
+xkl_xkm_cache_file_free(XklXkmCacheFile * file)
+{
+	g_free(file->file_name);
+	g_free(file);
+}
+
+/* Removes the least recently used keymaps while the cache is too big */
+static void
+xkl_xkm_cache_evict(void)
+{
+	gchar *dir_name = xkl_xkm_cache_get_dir();
+	GDir *dir = g_dir_open(dir_name, 0, NULL);
+	GPtrArray *files;
+	const gchar *name;
+	struct stat stat_buf;
+	guint64 total = 0;
+	guint i;
+
+	if (dir == NULL) {
+		g_free(dir_name);
+		return;
+	}
+
+	files = g_ptr_array_new_with_free_func((GDestroyNotify)
+					       xkl_xkm_cache_file_free);
+	while ((name = g_dir_read_name(dir)) != NULL) {
+		XklXkmCacheFile *file;
+		gchar *file_name;
+
+		if (!g_str_has_suffix(name, ".xkm"))
+			continue;
+		file_name = g_build_filename(dir_name, name, NULL);
+		if (stat(file_name, &stat_buf) != 0) {
+			g_free(file_name);
+			continue;
+		}
+		file = g_new(XklXkmCacheFile, 1);
+		file->file_name = file_name;
+		file->mtime = stat_buf.st_mtime;
+		file->size = stat_buf.st_size;
+		total += file->size;
+		g_ptr_array_add(files, file);
+	}
+	g_dir_close(dir);
+
+	g_ptr_array_sort(files, xkl_xkm_cache_file_compare);
+	for (i = 0; i < files->len && total > XKL_XKM_CACHE_MAX_SIZE; i++) {
+		XklXkmCacheFile *file = g_ptr_array_index(files, i);
+		xkl_debug(160, "Evicting the cached keymap %s\n",
+			  file->file_name);
+		if (remove(file->file_name) == 0)
+			total -= file->size;
+	}
+
+	g_ptr_array_free(files, TRUE);
+	g_free(dir_name);
+}
+
+static void
+xkl_xkm_cache_store(const gchar * xkm, gsize length,
+		    const gchar * cached_fn)
+{
+	gchar *dir = xkl_xkm_cache_get_dir();
+	GError *error = NULL;
+
+	if (g_mkdir_with_parents(dir, 0700) != 0)
+		xkl_debug(0, "Could not create the keymap cache %s: %d\n",
+			  dir, errno);
+	else if (!g_file_set_contents(cached_fn, xkm, length, &error)) {
+		xkl_debug(0, "Could not cache the keymap in %s: %s\n",
+			  cached_fn, error->message);
+		g_error_free(error);
+	} else {
+		xkl_debug(150, "Cached the keymap in %s\n", cached_fn);
+		xkl_xkm_cache_evict();
+	}
+	g_free(dir);
+}
+
+static gchar *
+xkl_config_get_keymap_source(XkbComponentNamesPtr component_names_ptr)
+{
+	return g_strdup_printf("xkb_keymap {\n"
+			       "        xkb_keycodes  { include \"%s\" };\n"
+			       "        xkb_types     { include \"%s\" };\n"
+			       "        xkb_compat    { include \"%s\" };\n"
+			       "        xkb_symbols   { include \"%s\" };\n"
+			       "        xkb_geometry  { include \"%s\" };\n"
+			       "};\n",
+			       component_names_ptr->keycodes,
+			       component_names_ptr->types,
+			       component_names_ptr->compat,
+			       component_names_ptr->symbols,
+			       component_names_ptr->geometry);
+}
+
+/*
+ * xkbcomp is run from several threads at once, the pipes are closed on
+ * exec so that no child keeps the ends of the other ones
+ */
+static gboolean
+xkl_config_open_pipe(int fds[2])
+{
+	GError *error = NULL;
+
+	if (g_unix_open_pipe(fds, FD_CLOEXEC, &error))
+		return TRUE;
+
+	xkl_debug(0, "Could not create the pipe: %s\n", error->message);
+	g_error_free(error);
+	return FALSE;
+}
+
+/*
+ * The keymap source goes to the pipe before xkbcomp is started: it is
+ * much smaller than the pipe buffer, and nothing can block or get
+ * SIGPIPE that way. The xkm comes back from the standard output.
+ */
+static gboolean
+xkl_config_feed_xkbcomp_input(const gchar * keymap, int in_fds[2])
+{
+	gsize length = strlen(keymap);
+	gssize written;
+
+	if (!xkl_config_open_pipe(in_fds))
+		return FALSE;
+
+	fcntl(in_fds[1], F_SETFL, O_NONBLOCK);
+	do
+		written = write(in_fds[1], keymap, length);
+	while (written == -1 && errno == EINTR);
+	close(in_fds[1]);
+
+	if (written != (gssize) length) {
+		xkl_debug(0, "Could not pass the keymap to %s: %d\n",
+			  XKBCOMP, errno);
+		close(in_fds[0]);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Compiles the keymap source, returns the xkm */
+static GByteArray *
+xkl_config_run_xkbcomp(const gchar * keymap, gboolean background)
+{
+	GByteArray *xkm;
+	pid_t cpid, pid;
+	int status = 0;
+	int in_fds[2], out_fds[2];
+	guint8 buf[4096];
+	gssize len;
+
+	if (!xkl_config_feed_xkbcomp_input(keymap, in_fds))
+		return NULL;
+
+	if (!xkl_config_open_pipe(out_fds)) {
+		close(in_fds[0]);
+		return NULL;
+	}
+
+	xkl_debug(160, "Executing %s\n", XKBCOMP);
+	xkl_debug(160, "%s %s %s %s %s %s %s %s\n",
+		  XKBCOMP, XKBCOMP, "-w0", "-I",
+		  "-I" XKB_BASE, "-xkm", "-", "-");
+
+	cpid = fork();
+	switch (cpid) {
+	case -1:
+		xkl_debug(0, "Could not fork: %d\n", errno);
+		close(in_fds[0]);
+		close(out_fds[0]);
+		close(out_fds[1]);
+		return NULL;
+	case 0:
+		/* child, the copies are not closed on exec */
+		dup2(in_fds[0], STDIN_FILENO);
+		dup2(out_fds[1], STDOUT_FILENO);
+		if (background)
+			setpriority(PRIO_PROCESS, 0, XKL_PRECOMPILE_NICE);
+		execl(XKBCOMP, XKBCOMP, "-w0", "-I",
+		      "-I" XKB_BASE, "-xkm", "-", "-", NULL);
+		_exit(127);
+	}
+
+	/* parent */
+	close(in_fds[0]);
+	close(out_fds[1]);
+
+	xkm = g_byte_array_new();
+	for (;;) {
+		len = read(out_fds[0], buf, sizeof buf);
+		if (len > 0)
+			g_byte_array_append(xkm, buf, len);
+		else if (len == 0 || errno != EINTR)
+			break;
+	}
+	close(out_fds[0]);
+
+	pid = waitpid(cpid, &status, 0);
+	xkl_debug(150,
+		  "Return status of %d (well, started %d): %d, %u bytes of xkm\n",
+		  pid, cpid, status, xkm->len);
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 127)
+		xkl_debug(0, "Could not exec %s\n", XKBCOMP);
+
+	if (xkm->len == 0) {
+		g_byte_array_free(xkm, TRUE);
+		return NULL;
+	}
+	return xkm;
+}
+
+/* The xkm as a stream, for XkmReadFile() */
+static FILE *
+xkl_config_open_xkm(GByteArray * xkm)
+{
+#ifdef HAVE_FMEMOPEN
+	return fmemopen(xkm->data, xkm->len, "r");
+#else
+	FILE *xkm_file = tmpfile();
+
+	if (xkm_file != NULL
+	    && (fwrite(xkm->data, 1, xkm->len, xkm_file) != xkm->len
+		|| fseek(xkm_file, 0, SEEK_SET) != 0)) {
+		fclose(xkm_file);
+		xkm_file = NULL;
+	}
+	return xkm_file;
+#endif
+}
+
+/* Reads the keyboard description, result->xkb is only kept on success */
+static gboolean
+xkl_config_read_xkm(Display * display, FILE * xkm, const gchar * source,
+		    XkbFileInfo * result)
+{
 	int xkmloadres;
 
-	Display *display = xkl_engine_get_display(engine);
+	memset((char *) result, 0, sizeof(*result));
+	result->xkb = XkbAllocKeyboard();
 
-	gchar *preactivation_group_description = activate ?
-	    xkl_config_get_current_group_description(engine) : NULL;
-
-	if (tmpnam(xkm_fn) != NULL && tmpnam(xkb_fn) != NULL) {
-		pid_t cpid, pid;
-		int status = 0;
-		FILE *tmpxkb;
-
-		xkl_debug(150, "tmp XKB/XKM file names: [%s]/[%s]\n",
-			  xkb_fn, xkm_fn);
-		if ((tmpxkb = fopen(xkb_fn, "w")) != NULL) {
-			fprintf(tmpxkb, "xkb_keymap {\n");
-			fprintf(tmpxkb,
-				"        xkb_keycodes  { include \"%s\" };\n",
-				component_names_ptr->keycodes);
-			fprintf(tmpxkb,
-				"        xkb_types     { include \"%s\" };\n",
-				component_names_ptr->types);
-			fprintf(tmpxkb,
-				"        xkb_compat    { include \"%s\" };\n",
-				component_names_ptr->compat);
-			fprintf(tmpxkb,
-				"        xkb_symbols   { include \"%s\" };\n",
-				component_names_ptr->symbols);
-			fprintf(tmpxkb,
-				"        xkb_geometry  { include \"%s\" };\n",
-				component_names_ptr->geometry);
-			fprintf(tmpxkb, "};\n");
-			fclose(tmpxkb);
-
-			xkl_debug(150, "xkb_keymap {\n"
-				  "        xkb_keycodes  { include \"%s\" };\n"
-				  "        xkb_types     { include \"%s\" };\n"
-				  "        xkb_compat    { include \"%s\" };\n"
-				  "        xkb_symbols   { include \"%s\" };\n"
-				  "        xkb_geometry  { include \"%s\" };\n};\n",
-				  component_names_ptr->keycodes,
-				  component_names_ptr->types,
-				  component_names_ptr->compat,
-				  component_names_ptr->symbols,
-				  component_names_ptr->geometry);
-
-			XSync(display, False);
-			/* From this point, ALL errors should be intercepted only by libxklavier */
-			xkl_engine_priv(engine, critical_section) = TRUE;
-
-			cpid = fork();
-			switch (cpid) {
-			case -1:
-				xkl_debug(0, "Could not fork: %d\n",
-					  errno);
-				break;
-			case 0:
-				/* child */
-				xkl_debug(160, "Executing %s\n", XKBCOMP);
-				xkl_debug(160, "%s %s %s %s %s %s %s %s\n",
-					  XKBCOMP, XKBCOMP, "-w0", "-I",
-					  "-I" XKB_BASE, "-xkm", xkb_fn,
-					  xkm_fn);
-				execl(XKBCOMP, XKBCOMP, "-w0", "-I",
-				      "-I" XKB_BASE, "-xkm", xkb_fn,
-				      xkm_fn, NULL);
-				xkl_debug(0, "Could not exec %s: %d\n",
-					  XKBCOMP, errno);
-				exit(1);
-			default:
-				/* parent */
-				pid = waitpid(cpid, &status, 0);
-				xkl_debug(150,
-					  "Return status of %d (well, started %d): %d\n",
-					  pid, cpid, status);
-				memset((char *) &result, 0,
-				       sizeof(result));
-				result.xkb = XkbAllocKeyboard();
-
-				if (Success ==
-				    XkbChangeKbdDisplay(display,
-							&result)) {
-					xkl_debug(150,
-						  "Hacked the kbddesc - set the display...\n");
-					if ((tmpxkm =
-					     fopen(xkm_fn, "r")) != NULL) {
-						xkmloadres =
-						    XkmReadFile(tmpxkm,
-								XkmKeymapLegal,
-								XkmKeymapLegal,
-								&result);
-						xkl_debug(150,
-							  "Loaded %s output as XKM file, got %d (comparing to %d)\n",
-							  XKBCOMP,
-							  (int) xkmloadres,
-							  (int)
-							  XkmKeymapLegal);
-						if ((int) xkmloadres !=
-						    (int) XkmKeymapLegal) {
-							xkl_debug(150,
-								  "Loaded legal keymap\n");
-							if (activate) {
-								xkl_debug
-								    (150,
-								     "Activating it...\n");
-								if (XkbWriteToServer(&result)) {
-									xkl_debug
-									    (150,
-									     "Updating the keyboard...\n");
-									xkb = result.xkb;
-								} else {
-									xkl_debug
-									    (0,
-									     "Could not write keyboard description to the server\n");
-								}
-							} else	/* no activate, just load */
-								xkb =
-								    result.xkb;
-						} else {	/* could not load properly */
-
-							xkl_debug(0,
-								  "Could not load %s output as XKM file, got %d (asked %d)\n",
-								  XKBCOMP,
-								  (int)
-								  xkmloadres,
-								  (int)
-								  XkmKeymapLegal);
-						}
-						fclose(tmpxkm);
-						xkl_debug(160,
-							  "Unlinking the temporary xkm file %s\n",
-							  xkm_fn);
-						if (xkl_debug_level < 500) {	/* don't remove on high debug levels! */
-							if (remove(xkm_fn)
-							    == -1)
-								xkl_debug
-								    (0,
-								     "Could not unlink the temporary xkm file %s: %d\n",
-								     xkm_fn,
-								     errno);
-						} else
-							xkl_debug(500,
-								  "Well, not really - the debug level is too high: %d\n",
-								  xkl_debug_level);
-					} else {	/* could not open the file */
-
-						xkl_debug(0,
-							  "Could not open the temporary xkm file %s\n",
-							  xkm_fn);
-					}
-				} else {	/* could not assign to display */
-
-					xkl_debug(0,
-						  "Could not change the keyboard description to display\n");
-				}
-				if (xkb == NULL)
-					XkbFreeKeyboard(result.xkb,
-							XkbAllComponentsMask,
-							True);
-				break;
+	if (Success != XkbChangeKbdDisplay(display, result)) {
+		xkl_debug(0,
+			  "Could not change the keyboard description to display\n");
+		XkbFreeKeyboard(result->xkb, XkbAllComponentsMask, True);
+		return FALSE;
+	}
+	xkl_debug(150, "Hacked the kbddesc - set the display...\n");
+
+	xkmloadres =
+	    XkmReadFile(xkm, XkmKeymapLegal, XkmKeymapLegal, result);
+	xkl_debug(150,
+		  "Loaded %s as XKM file, got %d (comparing to %d)\n",
+		  source, (int) xkmloadres, (int) XkmKeymapLegal);
+
+	if ((int) xkmloadres == (int) XkmKeymapLegal) {
+		xkl_debug(0,
+			  "Could not load %s as XKM file, got %d (asked %d)\n",
+			  source, (int) xkmloadres, (int) XkmKeymapLegal);
+		XkbFreeKeyboard(result->xkb, XkbAllComponentsMask, True);
+		return FALSE;
+	}
+	xkl_debug(150, "Loaded legal keymap\n");
+	return TRUE;
+}
+
+/*
+ * Takes the xkm from the cache file, compiles it if it is not there.
+ * No X calls, so it can be done in any thread.
+ */
+static GByteArray *
+xkl_config_compile_cached_keymap(const gchar * keymap,
+				 const gchar * cached_fn)
+{
+	GByteArray *xkm;
+	gchar *contents;
+	gsize length;
+
+	if (g_file_get_contents(cached_fn, &contents, &length, NULL)) {
+		if (length > 0) {
+			xkl_debug(150, "Took the keymap from %s\n",
+				  cached_fn);
+			/* the eviction goes by the time of the last use */
+			utime(cached_fn, NULL);
+			return g_byte_array_new_take((guint8 *) contents,
+						     length);
+		}
+		g_free(contents);
+	}
+
+	xkm = xkl_config_run_xkbcomp(keymap, FALSE);
+	if (xkm != NULL)
+		xkl_xkm_cache_store((const gchar *) xkm->data, xkm->len,
+				    cached_fn);
+	return xkm;
+}
+
+static GByteArray *
+xkl_config_compile_keymap(const gchar * keymap, gchar ** cached_fn_out)
+{
+	*cached_fn_out = xkl_xkm_cache_get_file_name(keymap);
+	return xkl_config_compile_cached_keymap(keymap, *cached_fn_out);
+}
+
+/* The parts of the keymap, as resolved by the rules */
+#define XKL_XKB_KEYCODES  ( 1 << 0 )
+#define XKL_XKB_TYPES     ( 1 << 1 )
+#define XKL_XKB_COMPAT    ( 1 << 2 )
+#define XKL_XKB_SYMBOLS   ( 1 << 3 )
+#define XKL_XKB_GEOMETRY  ( 1 << 4 )
+#define XKL_XKB_ALL_COMPONENTS ( ( 1 << 5 ) - 1 )
+
+static guint
+xkl_xkb_diff_components(XkbComponentNamesPtr names1,
+			XkbComponentNamesPtr names2)
+{
+	guint changed = 0;
+
+	if (g_strcmp0(names1->keycodes, names2->keycodes))
+		changed |= XKL_XKB_KEYCODES;
+	if (g_strcmp0(names1->types, names2->types))
+		changed |= XKL_XKB_TYPES;
+	if (g_strcmp0(names1->compat, names2->compat))
+		changed |= XKL_XKB_COMPAT;
+	if (g_strcmp0(names1->symbols, names2->symbols))
+		changed |= XKL_XKB_SYMBOLS;
+	if (g_strcmp0(names1->geometry, names2->geometry))
+		changed |= XKL_XKB_GEOMETRY;
+	return changed;
+}
+
+/*
+ * Compares the configuration with the one stored on the root window.
+ * Returns the parts of the keymap which differ, or -1 if the server
+ * has the very same configuration.
+ */
+static gint
+xkl_xkb_compare_with_server(XklEngine * engine, const XklConfigRec * data,
+			    XkbComponentNamesPtr component_names)
+{
+	XklConfigRec *current = xkl_config_rec_new();
+	XkbComponentNamesRec current_names;
+	gchar *rules_file = NULL;
+	gint changed = XKL_XKB_ALL_COMPONENTS;
+
+	if (xkl_config_rec_get_from_root_window_property
+	    (current, xkl_engine_priv(engine, base_config_atom),
+	     &rules_file, engine)
+	    && !g_strcmp0(rules_file,
+			  xkl_engine_get_ruleset_name(engine,
+						      XKB_DEFAULT_RULESET)))
+	{
+		if (xkl_config_rec_equals(current, (XklConfigRec *) data))
+			changed = -1;
+		else {
+			memset(&current_names, 0, sizeof(current_names));
+			if (xkl_xkb_config_native_prepare
+			    (engine, current, &current_names)) {
+				changed =
+				    xkl_xkb_diff_components(&current_names,
+							    component_names);
+				xkl_xkb_config_native_cleanup(engine,
+							      &current_names);
 			}
-			XSync(display, False);
-			/* Return to normal X error processing */
-			xkl_engine_priv(engine, critical_section) = FALSE;
-
-			if (activate)
-				xkl_config_set_group_by_description(engine,
-								    preactivation_group_description);
-
-			xkl_debug(160,
-				  "Unlinking the temporary xkb file %s\n",
-				  xkb_fn);
-			if (xkl_debug_level < 500) {	/* don't remove on high debug levels! */
-				if (remove(xkb_fn) == -1)
-					xkl_debug(0,
-						  "Could not unlink the temporary xkb file %s: %d\n",
-						  xkb_fn, errno);
-			} else
-				xkl_debug(500,
-					  "Well, not really - the debug level is too high: %d\n",
-					  xkl_debug_level);
-		} else {	/* could not open input tmp file */
+		}
+	}
+	xkl_debug(150, "Changed parts of the keymap: %d\n", changed);
+
+	g_free(rules_file);
+	g_object_unref(G_OBJECT(current));
+	return changed;
+}
 
+/*
+ * XkbWriteToServer(), for the changed parts only. The key actions come
+ * from the compat interpretations, so the compat changes the map too.
+ */
+static gboolean
+xkl_xkb_write_to_server(XkbFileInfo * result, guint changed)
+{
+	XkbDescPtr xkb = result->xkb;
+	Display *display = xkb->dpy;
+
+	if ((changed & (XKL_XKB_KEYCODES | XKL_XKB_TYPES | XKL_XKB_COMPAT |
+			XKL_XKB_SYMBOLS))
+	    && !XkbSetMap(display, XkbAllMapComponentsMask, xkb))
+		return FALSE;
+	if (changed & XKL_XKB_COMPAT) {
+		if (!XkbSetIndicatorMap(display, ~0, xkb))
+			return FALSE;
+		if (!XkbSetCompatMap(display, XkbAllCompatMask, xkb, True))
+			return FALSE;
+	}
+	if (!XkbSetNames
+	    (display, XkbAllNamesMask, 0, xkb->map->num_types, xkb))
+		return FALSE;
+	if ((changed & XKL_XKB_GEOMETRY) && xkb->geom != NULL
+	    && XkbSetGeometry(display, xkb->device_spec,
+			      xkb->geom) != Success)
+		return FALSE;
+	return TRUE;
+}
+
+/*
+ * Loads the xkm and (if asked) sends the changed parts to the server,
+ * then locks the group with the given description (taken over)
+ */
+static XkbDescPtr
+xkl_config_upload_keyboard(XklEngine * engine, GByteArray * xkm,
+			   const gchar * cached_fn, gboolean activate,
+			   guint changed, gchar * group_description)
+{
+	XkbDescPtr xkb = NULL;
+	XkbFileInfo result;
+	FILE *xkm_file;
+
+	Display *display = xkl_engine_get_display(engine);
+
+	XSync(display, False);
+	/* From this point, ALL errors should be intercepted only by libxklavier */
+	xkl_engine_priv(engine, critical_section) = TRUE;
+
+	if ((xkm_file = xkl_config_open_xkm(xkm)) == NULL) {
+		xkl_debug(0, "Could not open the xkm: %d\n", errno);
+	} else if (!xkl_config_read_xkm
+		   (display, xkm_file, cached_fn, &result)) {
+		/* do not take it from the cache next time */
+		remove(cached_fn);
+	} else if (activate) {
+		xkl_debug(150, "Activating it...\n");
+		if (xkl_xkb_write_to_server(&result, changed)) {
+			xkl_debug(150, "Updating the keyboard...\n");
+			xkb = result.xkb;
+		} else {
 			xkl_debug(0,
-				  "Could not open tmp XKB file [%s]: %d\n",
-				  xkb_fn, errno);
+				  "Could not write keyboard description to the server\n");
+			XkbFreeKeyboard(result.xkb, XkbAllComponentsMask,
+					True);
 		}
-	} else {
-		xkl_debug(0, "Could not get tmp names\n");
+	} else			/* no activate, just load */
+		xkb = result.xkb;
+
+	if (xkm_file != NULL)
+		fclose(xkm_file);
+
+	/* no sync in between, the one below covers the lock too */
+	if (activate)
+		xkl_config_set_group_by_description(engine, xkb,
+						    group_description);
+	else
+		g_free(group_description);
+
+	XSync(display, False);
+	/* Return to normal X error processing */
+	xkl_engine_priv(engine, critical_section) = FALSE;
+
+	return xkb;
+}
+
+/* Just loads the keyboard description, for writing it out */
+static XkbDescPtr
+xkl_config_get_keyboard(XklEngine * engine,
+			XkbComponentNamesPtr component_names_ptr)
+{
+	XkbDescPtr xkb = NULL;
+	GByteArray *xkm;
+	gchar *keymap, *cached_fn;
+
+	keymap = xkl_config_get_keymap_source(component_names_ptr);
+	xkl_debug(150, "%s", keymap);
+
+	xkm = xkl_config_compile_keymap(keymap, &cached_fn);
+	if (xkm != NULL) {
+		xkb =
+		    xkl_config_upload_keyboard(engine, xkm, cached_fn,
+					       FALSE,
+					       XKL_XKB_ALL_COMPONENTS,
+					       NULL);
+		g_byte_array_free(xkm, TRUE);
 	}
 
+	g_free(cached_fn);
+	g_free(keymap);
 	return xkb;
 }
+
+static gboolean
+xkl_xkb_config_rec_set_property(XklEngine * engine,
+				const XklConfigRec * data)
+{
+	if (xkl_config_rec_set_to_root_window_property
+	    (data,
+	     xkl_engine_priv(engine, base_config_atom),
+	     xkl_engine_get_ruleset_name(engine, XKB_DEFAULT_RULESET),
+	     engine))
+		/* We do not need to check the result of _XklGetRulesSetName - 
+		   because PrepareBeforeKbd did it for us */
+		return TRUE;
+	xkl_last_error_message = "Could not set names property";
+	return FALSE;
+}
+
+/* Stores the configuration on the root window once it is activated */
+static gboolean
+xkl_xkb_config_rec_activated(XklEngine * engine, const XklConfigRec * data,
+			     XkbDescPtr xkb)
+{
+	gboolean rv = FALSE;
+
+	if (xkb != NULL) {
+		rv = xkl_xkb_config_rec_set_property(engine, data);
+		XkbFreeKeyboard(xkb, XkbAllComponentsMask, True);
+	} else {
+		xkl_last_error_message =
+		    "Could not load keyboard description";
+	}
+	return rv;
+}
+
+typedef struct {
+	XklConfigRec *data;
+	gchar *keymap;
+	GByteArray *xkm;
+	gchar *cached_fn;
+	gint changed;
+} XklXkbActivation;
+
+static void
+xkl_xkb_activation_free(XklXkbActivation * activation)
+{
+	g_object_unref(G_OBJECT(activation->data));
+	g_free(activation->keymap);
+	if (activation->xkm != NULL)
+		g_byte_array_free(activation->xkm, TRUE);
+	g_free(activation->cached_fn);
+	g_free(activation);
+}
+
+/* The cache file name is already there */
+static gpointer
+xkl_xkb_activation_compile_thread(gpointer data)
+{
+	XklXkbActivation *activation = data;
+
+	activation->xkm =
+	    xkl_config_compile_cached_keymap(activation->keymap,
+					     activation->cached_fn);
+	return NULL;
+}
+
+static void
+xkl_xkb_activation_compile(GTask * compile, gpointer source_object,
+			   gpointer task_data, GCancellable * cancellable)
+{
+	XklXkbActivation *activation = task_data;
+
+	activation->xkm =
+	    xkl_config_compile_keymap(activation->keymap,
+				      &activation->cached_fn);
+	if (activation->xkm != NULL)
+		g_task_return_boolean(compile, TRUE);
+	else
+		g_task_return_new_error(compile, G_IO_ERROR,
+					G_IO_ERROR_FAILED,
+					"Could not compile the keymap");
+}
+
+/* The stages of the activation are timed at this debug level */
+#define XKL_ACTIVATION_TIMING_LEVEL 100
+
+static void
+xkl_xkb_activation_stage(const gchar * stage, gint64 * start)
+{
+	gint64 now = g_get_monotonic_time();
+
+	xkl_debug(XKL_ACTIVATION_TIMING_LEVEL,
+		  "Activation stage %s: %" G_GINT64_FORMAT " us\n", stage,
+		  now - *start);
+	*start = now;
+}
+
+/* Back in the context of the caller, the keymap goes to the server */
+static void
+xkl_xkb_activation_compiled(GObject * source_object, GAsyncResult * res,
+			    gpointer user_data)
+{
+	XklEngine *engine = XKL_ENGINE(source_object);
+	GTask *task = G_TASK(user_data);
+	XklXkbActivation *activation = g_task_get_task_data(G_TASK(res));
+	XkbComponentNamesRec component_names;
+	GError *error = NULL;
+
+	if (g_task_return_error_if_cancelled(task)) {
+		g_object_unref(task);
+		return;
+	}
+
+	if (!g_task_propagate_boolean(G_TASK(res), &error)) {
+		g_task_return_error(task, error);
+		g_object_unref(task);
+		return;
+	}
+
+	/*
+	 * Another activation may have landed while the keymap was being
+	 * compiled, the changed parts are taken against the server again
+	 */
+	xkl_engine_flush_pending_reset(engine);
+	memset(&component_names, 0, sizeof(component_names));
+	if (xkl_xkb_config_native_prepare
+	    (engine, activation->data, &component_names)) {
+		activation->changed =
+		    xkl_xkb_compare_with_server(engine, activation->data,
+						&component_names);
+		xkl_xkb_config_native_cleanup(engine, &component_names);
+	} else
+		activation->changed = XKL_XKB_ALL_COMPONENTS;
+
+	if (activation->changed <= 0)
+		xkl_config_rec_activation_return(task,
+						 activation->changed < 0
+						 ||
+						 xkl_xkb_config_rec_set_property
+						 (engine, activation->data));
+	else
+		xkl_config_rec_activation_return(task,
+						 xkl_xkb_config_rec_activated
+						 (engine, activation->data,
+						  xkl_config_upload_keyboard
+						  (engine, activation->xkm,
+						   activation->cached_fn,
+						   TRUE,
+						   activation->changed,
+						   xkl_config_get_current_group_description
+						   (engine))));
+	g_object_unref(task);
+}
+
+void
+xkl_xkb_activate_config_rec_async(XklEngine * engine,
+				  const XklConfigRec * data,
+				  GCancellable * cancellable,
+				  GAsyncReadyCallback callback,
+				  gpointer user_data)
+{
+	XkbComponentNamesRec component_names;
+	XklXkbActivation *activation;
+	GTask *task, *compile;
+	gint changed;
+
+	task = g_task_new(engine, cancellable, callback, user_data);
+	g_task_set_source_tag(task, xkl_xkb_activate_config_rec_async);
+
+	/* the rules are cached, resolving them is cheap */
+	memset(&component_names, 0, sizeof(component_names));
+	if (!xkl_xkb_config_native_prepare(engine, data, &component_names)) {
+		xkl_config_rec_activation_return(task, FALSE);
+		g_object_unref(task);
+		return;
+	}
+
+	/* nothing to compile if the keymap stays */
+	changed =
+	    xkl_xkb_compare_with_server(engine, data, &component_names);
+	if (changed <= 0) {
+		xkl_xkb_config_native_cleanup(engine, &component_names);
+		xkl_config_rec_activation_return(task, changed < 0 ||
+						 xkl_xkb_config_rec_set_property
+						 (engine, data));
+		g_object_unref(task);
+		return;
+	}
+
+	activation = g_new0(XklXkbActivation, 1);
+	activation->changed = changed;
+	activation->data = xkl_config_rec_new();
+	xkl_config_rec_set_model(activation->data, data->model);
+	xkl_config_rec_set_layouts(activation->data,
+				   (const gchar **) data->layouts);
+	xkl_config_rec_set_variants(activation->data,
+				    (const gchar **) data->variants);
+	xkl_config_rec_set_options(activation->data,
+				   (const gchar **) data->options);
+	activation->keymap =
+	    xkl_config_get_keymap_source(&component_names);
+	xkl_debug(150, "%s", activation->keymap);
+	xkl_xkb_config_native_cleanup(engine, &component_names);
+
+	/* the compilation is not interrupted, the cache gets the keymap */
+	compile =
+	    g_task_new(engine, cancellable, xkl_xkb_activation_compiled,
+		       task);
+	g_task_set_task_data(compile, activation,
+			     (GDestroyNotify) xkl_xkb_activation_free);
+	g_task_set_return_on_cancel(compile, TRUE);
+	g_task_run_in_thread(compile, xkl_xkb_activation_compile);
+	g_object_unref(compile);
+}
+
+/* The keymaps queued or being compiled, owned by the table */
+static GHashTable *xkl_precompile_pending;
+static GThreadPool *xkl_precompile_pool;
+static GMutex xkl_precompile_mutex;
+
+static void
+xkl_xkb_precompile_keymap(gpointer data, gpointer user_data)
+{
+	gchar *keymap = data;
+	gchar *cached_fn = xkl_xkm_cache_get_file_name(keymap);
+	GByteArray *xkm;
+
+	if (!g_file_test(cached_fn, G_FILE_TEST_EXISTS)) {
+		xkm = xkl_config_run_xkbcomp(keymap, TRUE);
+		if (xkm != NULL) {
+			xkl_xkm_cache_store((const gchar *) xkm->data,
+					    xkm->len, cached_fn);
+			g_byte_array_free(xkm, TRUE);
+		}
+	}
+	g_free(cached_fn);
+
+	g_mutex_lock(&xkl_precompile_mutex);
+	if (xkl_precompile_pending != NULL)
+		g_hash_table_remove(xkl_precompile_pending, keymap);
+	g_mutex_unlock(&xkl_precompile_mutex);
+}
+
+gboolean
+xkl_xkb_precompile_config_rec(XklEngine * engine,
+			      const XklConfigRec * data)
+{
+	XkbComponentNamesRec component_names;
+	gboolean rv = TRUE;
+	gchar *keymap;
+
+	memset(&component_names, 0, sizeof(component_names));
+	if (!xkl_xkb_config_native_prepare(engine, data, &component_names))
+		return FALSE;
+	keymap = xkl_config_get_keymap_source(&component_names);
+	xkl_xkb_config_native_cleanup(engine, &component_names);
+
+	g_mutex_lock(&xkl_precompile_mutex);
+	if (xkl_precompile_pool == NULL) {
+		xkl_precompile_pending =
+		    g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+					  NULL);
+		xkl_precompile_pool =
+		    g_thread_pool_new(xkl_xkb_precompile_keymap, NULL,
+				      XKL_PRECOMPILE_MAX_THREADS, FALSE,
+				      NULL);
+	}
+
+	if (g_hash_table_contains(xkl_precompile_pending, keymap)) {
+		xkl_debug(160, "The keymap is already queued\n");
+		g_free(keymap);
+	} else if (g_hash_table_size(xkl_precompile_pending) >=
+		   XKL_PRECOMPILE_MAX_PENDING) {
+		xkl_last_error_message = "Too many keymaps are queued";
+		g_free(keymap);
+		rv = FALSE;
+	} else {
+		xkl_debug(160, "Queueing the keymap for compilation\n");
+		g_hash_table_add(xkl_precompile_pending, keymap);
+		g_thread_pool_push(xkl_precompile_pool, keymap, NULL);
+	}
+	g_mutex_unlock(&xkl_precompile_mutex);
+	return rv;
+}
+
+/* Drops the queued keymaps, waits for the one being compiled */
+void
+xkl_xkb_precompile_free(void)
+{
+	GThreadPool *pool;
+	GHashTable *pending;
+
+	g_mutex_lock(&xkl_precompile_mutex);
+	pool = xkl_precompile_pool;
+	pending = xkl_precompile_pending;
+	xkl_precompile_pool = NULL;
+	xkl_precompile_pending = NULL;
+	g_mutex_unlock(&xkl_precompile_mutex);
+
+	if (pool == NULL)
+		return;
+	g_thread_pool_free(pool, TRUE, TRUE);
+	g_hash_table_destroy(pending);
+}
 #else				/* no XKB headers */
 gboolean
 xkl_xkb_config_native_prepare(XklEngine * engine,
@@ -512,37 +1284,120 @@ xkl_xkb_activate_config_rec(XklEngine * engine, const XklConfigRec * data)
 
 #ifdef LIBXKBFILE_PRESENT
 	XkbComponentNamesRec component_names;
+	XklXkbActivation activation;
+	XkbDescPtr xkb = NULL;
+	GThread *compiler = NULL;
+	GError *error = NULL;
+	gchar *group_description;
+	gint64 start = g_get_monotonic_time(), stage_start = start;
+	gint changed;
+
 	memset(&component_names, 0, sizeof(component_names));
+	if (!xkl_xkb_config_native_prepare(engine, data, &component_names))
+		return FALSE;
+	xkl_xkb_activation_stage("rules", &stage_start);
 
-	if (xkl_xkb_config_native_prepare(engine, data, &component_names)) {
-		XkbDescPtr xkb;
-		xkb =
-		    xkl_config_get_keyboard(engine, &component_names,
-					    TRUE);
-		if (xkb != NULL) {
-			if (xkl_config_rec_set_to_root_window_property
-			    (data,
-			     xkl_engine_priv(engine, base_config_atom),
-			     xkl_engine_get_ruleset_name(engine,
-							 XKB_DEFAULT_RULESET),
-			     engine))
-				/* We do not need to check the result of _XklGetRulesSetName - 
-				   because PrepareBeforeKbd did it for us */
-				rv = TRUE;
-			else
-				xkl_last_error_message =
-				    "Could not set names property";
-			XkbFreeKeyboard(xkb, XkbAllComponentsMask, True);
-		} else {
-			xkl_last_error_message =
-			    "Could not load keyboard description";
-		}
+	changed =
+	    xkl_xkb_compare_with_server(engine, data, &component_names);
+	xkl_xkb_activation_stage("comparison", &stage_start);
+	if (changed <= 0) {
 		xkl_xkb_config_native_cleanup(engine, &component_names);
+		if (changed == 0)
+			return xkl_xkb_config_rec_set_property(engine,
+							       data);
+		xkl_debug(150, "The configuration is already active\n");
+		return TRUE;
+	}
+
+	memset(&activation, 0, sizeof(activation));
+	activation.keymap = xkl_config_get_keymap_source(&component_names);
+	xkl_debug(150, "%s", activation.keymap);
+	xkl_xkb_config_native_cleanup(engine, &component_names);
+
+	/*
+	 * The server is asked for the current group while xkbcomp runs.
+	 * A cached keymap is just read, and a tracked state needs no
+	 * round trip: nothing to overlap then.
+	 */
+	activation.cached_fn =
+	    xkl_xkm_cache_get_file_name(activation.keymap);
+	if (!g_file_test(activation.cached_fn, G_FILE_TEST_EXISTS)
+	    && !xkl_xkb_is_server_state_tracked(engine)) {
+		compiler =
+		    g_thread_try_new("xkl-compile",
+				     xkl_xkb_activation_compile_thread,
+				     &activation, &error);
+		if (compiler == NULL) {
+			xkl_debug(0,
+				  "Could not start the compile thread: %s\n",
+				  error->message);
+			g_error_free(error);
+		}
+	}
+	/* without the thread, nothing is overlapped */
+	if (compiler == NULL) {
+		xkl_xkb_activation_compile_thread(&activation);
+		xkl_xkb_activation_stage("compilation", &stage_start);
+	}
+	group_description =
+	    xkl_config_get_current_group_description(engine);
+	xkl_xkb_activation_stage("state", &stage_start);
+	if (compiler != NULL) {
+		g_thread_join(compiler);
+		xkl_xkb_activation_stage("compilation", &stage_start);
 	}
+
+	if (activation.xkm != NULL) {
+		xkb = xkl_config_upload_keyboard(engine, activation.xkm,
+						 activation.cached_fn, TRUE,
+						 changed, group_description);
+		xkl_xkb_activation_stage("upload", &stage_start);
+		g_byte_array_free(activation.xkm, TRUE);
+	} else
+		g_free(group_description);
+
+	rv = xkl_xkb_config_rec_activated(engine, data, xkb);
+	xkl_xkb_activation_stage("property", &stage_start);
+	xkl_debug(XKL_ACTIVATION_TIMING_LEVEL,
+		  "Activation took %" G_GINT64_FORMAT " us\n",
+		  g_get_monotonic_time() - start);
+
+	g_free(activation.cached_fn);
+	g_free(activation.keymap);
 #endif
 	return rv;
 }
 
+#ifdef LIBXKBFILE_PRESENT
+/* The failure goes to *error */
+static gboolean
+xkl_xkb_write_keyboard(XkbDescPtr xkb, const gchar * file_name,
+		       const gboolean binary, const gchar ** error)
+{
+	gboolean rv;
+	FILE *output = fopen(file_name, "w");
+	XkbFileInfo dump_info;
+
+	if (output == NULL) {
+		*error = "Could not open the XKB file";
+		return FALSE;
+	}
+
+	dump_info.defined = 0;
+	dump_info.xkb = xkb;
+	dump_info.type = XkmKeymapFile;
+	if (binary)
+		rv = XkbWriteXKMFile(output, &dump_info);
+	else
+		rv = XkbWriteXKBFile(output, &dump_info, True, NULL, NULL);
+	if (!rv)
+		*error = "Could not write the XKB file";
+
+	fclose(output);
+	return rv;
+}
+#endif
+
 gboolean
 xkl_xkb_write_config_rec_to_file(XklEngine * engine, const char *file_name,
 				 const XklConfigRec * data,
@@ -552,31 +1407,16 @@ xkl_xkb_write_config_rec_to_file(XklEngine * engine, const char *file_name,
 
 #ifdef LIBXKBFILE_PRESENT
 	XkbComponentNamesRec component_names;
-	FILE *output = fopen(file_name, "w");
-	XkbFileInfo dump_info;
-
-	if (output == NULL) {
-		xkl_last_error_message = "Could not open the XKB file";
-		return FALSE;
-	}
 
 	memset(&component_names, 0, sizeof(component_names));
 
 	if (xkl_xkb_config_native_prepare(engine, data, &component_names)) {
 		XkbDescPtr xkb;
-		xkb =
-		    xkl_config_get_keyboard(engine, &component_names,
-					    FALSE);
+		xkb = xkl_config_get_keyboard(engine, &component_names);
 		if (xkb != NULL) {
-			dump_info.defined = 0;
-			dump_info.xkb = xkb;
-			dump_info.type = XkmKeymapFile;
-			if (binary)
-				rv = XkbWriteXKMFile(output, &dump_info);
-			else
-				rv = XkbWriteXKBFile(output, &dump_info,
-						     True, NULL, NULL);
-
+			rv = xkl_xkb_write_keyboard(xkb, file_name,
+						    binary,
+						    &xkl_last_error_message);
 			XkbFreeKeyboard(xkb, XkbGBN_AllComponentsMask,
 					True);
 		} else
@@ -584,7 +1424,186 @@ xkl_xkb_write_config_rec_to_file(XklEngine * engine, const char *file_name,
 			    "Could not load keyboard description";
 		xkl_xkb_config_native_cleanup(engine, &component_names);
 	}
-	fclose(output);
+#endif
+	return rv;
+}
+
+#ifdef LIBXKBFILE_PRESENT
+typedef struct {
+	XklConfigRecExportJob *job;
+	gchar *keymap;
+	gchar *cached_fn;
+	GByteArray *xkm;
+} XklXkbExport;
+
+/* Runs in the pool, the X side stays in the calling thread */
+static void
+xkl_xkb_export_compile(gpointer data, gpointer user_data)
+{
+	XklXkbExport *export = data;
+
+	export->xkm =
+	    xkl_config_compile_keymap(export->keymap, &export->cached_fn);
+	g_async_queue_push((GAsyncQueue *) user_data, export);
+}
+
+/*
+ * The errors are set per job: the global message is shared with the
+ * other threads compiling keymaps
+ */
+static gboolean
+xkl_xkb_export_write(XklEngine * engine, XklXkbExport * export)
+{
+	XklConfigRecExportJob *job = export->job;
+	XkbDescPtr xkb = NULL;
+
+	if (export->xkm == NULL)
+		job->error =
+		    xkl_xkb_config_validity_message
+		    (XKL_CONFIG_REC_NOT_COMPILED);
+	else {
+		xkb = xkl_config_upload_keyboard(engine, export->xkm,
+						 export->cached_fn, FALSE,
+						 XKL_XKB_ALL_COMPONENTS,
+						 NULL);
+		g_byte_array_free(export->xkm, TRUE);
+		if (xkb == NULL)
+			job->error = "Could not load keyboard description";
+	}
+
+	if (xkb != NULL) {
+		job->written =
+		    xkl_xkb_write_keyboard(xkb, job->file_name,
+					   job->binary, &job->error);
+		XkbFreeKeyboard(xkb, XkbGBN_AllComponentsMask, True);
+	}
+
+	g_free(export->cached_fn);
+	g_free(export->keymap);
+	g_free(export);
+	return job->written;
+}
+#endif
+
+guint
+xkl_xkb_write_config_rec_to_files(XklEngine * engine,
+				  XklConfigRecExportJob * jobs,
+				  guint n_jobs, guint max_processes,
+				  XklConfigRecExportFunc func,
+				  gpointer data)
+{
+	guint written = 0;
+
+#ifdef LIBXKBFILE_PRESENT
+	XkbComponentNamesRec component_names;
+	XklConfigRecValidity validity;
+	XklConfigRecExportJob *job;
+	XklXkbExport *export;
+	GAsyncQueue *compiled = g_async_queue_new();
+	GThreadPool *pool;
+	GError *error = NULL;
+	guint i, done = 0, queued = 0;
+
+	if (max_processes == 0)
+		max_processes = g_get_num_processors();
+	/* no idle threads */
+	max_processes = MAX(MIN(max_processes, n_jobs), 1);
+	/*
+	 * The threads are started up front: the keymaps queued are sure to
+	 * be compiled, and a failure shows right here
+	 */
+	pool = g_thread_pool_new(xkl_xkb_export_compile, compiled,
+				 max_processes, TRUE, &error);
+	if (pool == NULL) {
+		xkl_debug(0,
+			  "Could not start the compilation threads: %s\n",
+			  error->message);
+		g_error_free(error);
+	}
+
+	/* the rules are resolved here, they are cached after the first job */
+	for (i = 0; i < n_jobs; i++) {
+		job = jobs + i;
+		memset(&component_names, 0, sizeof(component_names));
+		validity =
+		    xkl_xkb_config_resolve_for_engine(engine, job->data,
+						      &component_names);
+		if (validity != XKL_CONFIG_REC_VALID) {
+			job->error =
+			    xkl_xkb_config_validity_message(validity);
+			if (func != NULL)
+				func(job, ++done, n_jobs, data);
+			continue;
+		}
+		export = g_new0(XklXkbExport, 1);
+		export->job = job;
+		export->keymap =
+		    xkl_config_get_keymap_source(&component_names);
+		xkl_xkb_config_native_cleanup(engine, &component_names);
+		if (pool != NULL) {
+			g_thread_pool_push(pool, export, NULL);
+			queued++;
+			continue;
+		}
+		/* no threads, the jobs are done one by one */
+		export->xkm =
+		    xkl_config_compile_keymap(export->keymap,
+					      &export->cached_fn);
+		if (xkl_xkb_export_write(engine, export))
+			written++;
+		if (func != NULL)
+			func(job, ++done, n_jobs, data);
+	}
+	xkl_debug(150, "Compiling %d keymaps in up to %d processes\n",
+		  queued, max_processes);
+
+	/* the files are written as the keymaps come */
+	while (queued-- > 0) {
+		export = g_async_queue_pop(compiled);
+		job = export->job;
+		if (xkl_xkb_export_write(engine, export))
+			written++;
+		if (func != NULL)
+			func(job, ++done, n_jobs, data);
+	}
+
+	if (pool != NULL)
+		g_thread_pool_free(pool, FALSE, TRUE);
+	g_async_queue_unref(compiled);
+#endif
+	return written;
+}
+
+/* Any thread: the reason is returned, the last error message is left alone */
+XklConfigRecValidity
+xkl_config_rec_validate(const XklConfigRec * data, const gchar * ruleset,
+			gboolean compile)
+{
+	XklConfigRecValidity rv = XKL_CONFIG_REC_NO_RULES;
+
+#ifdef LIBXKBFILE_PRESENT
+	XkbComponentNamesRec component_names;
+	GByteArray *xkm;
+	gchar *keymap, *cached_fn;
+
+	memset(&component_names, 0, sizeof(component_names));
+	rv = xkl_xkb_config_resolve(ruleset !=
+				    NULL ? ruleset : XKB_DEFAULT_RULESET,
+				    data, &component_names);
+	if (rv != XKL_CONFIG_REC_VALID)
+		return rv;
+
+	if (compile) {
+		keymap = xkl_config_get_keymap_source(&component_names);
+		xkm = xkl_config_compile_keymap(keymap, &cached_fn);
+		if (xkm != NULL)
+			g_byte_array_free(xkm, TRUE);
+		else
+			rv = XKL_CONFIG_REC_NOT_COMPILED;
+		g_free(cached_fn);
+		g_free(keymap);
+	}
+	xkl_xkb_config_native_cleanup(NULL, &component_names);
 #endif
 	return rv;
 }
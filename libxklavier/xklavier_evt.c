@@ -26,8 +26,8 @@
 
 #include "xklavier_private.h"
 
-gint
-xkl_engine_filter_events(XklEngine * engine, XEvent * xev)
+static gint
+xkl_engine_filter_event(XklEngine * engine, XEvent * xev)
 {
 	XAnyEvent *pe = (XAnyEvent *) xev;
 	xkl_debug(400,
@@ -76,8 +76,8 @@ xkl_engine_filter_events(XklEngine * engine, XEvent * xev)
 		case MappingNotify:
 			xkl_debug(200, "%s\n",
 				  xkl_event_get_name(xev->type));
-			xkl_engine_reset_all_info(engine, FALSE,
-						  "X event: MappingNotify");
+			xkl_engine_reset_all_info_deferred(engine, FALSE,
+							   "X event: MappingNotify");
 			break;
 		default:
 			{
@@ -92,6 +92,16 @@ xkl_engine_filter_events(XklEngine * engine, XEvent * xev)
 	return 1;
 }
 
+
+gint
+xkl_engine_filter_events(XklEngine * engine, XEvent * xev)
+{
+	gint rv = xkl_engine_filter_event(engine, xev);
+
+	xkl_engine_reset_all_info_if_idle(engine);
+	return rv;
+}
+
 /*
  * FocusIn handler
  */
@@ -429,7 +439,7 @@ xkl_engine_process_property_evt(XklEngine * engine, XPropertyEvent * pev)
 			if (pev->state == PropertyNewValue) {
 				/* If root window got new *_NAMES_PROP_ATOM -
 				   it most probably means new keyboard config is loaded by somebody */
-				xkl_engine_reset_all_info
+				xkl_engine_reset_all_info_deferred
 				    (engine, TRUE,
 				     "New value of *_NAMES_PROP_ATOM on root window");
 			}
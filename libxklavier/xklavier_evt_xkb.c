@@ -44,6 +44,39 @@ xkl_xinput_process_x_event(XklEngine * engine, XEvent * xev)
 }
 #endif
 
+#ifdef LIBXKBFILE_PRESENT
+/*
+ * Tells from the details of the event whether the cached info (the
+ * number of groups, the group and indicator names) is still valid,
+ * so that most of the notifications need no requests at all.
+ */
+static gboolean
+xkl_xkb_config_event_is_noop(XklEngine * engine, XkbEvent * kev)
+{
+	XkbDescPtr cached =
+	    xkl_engine_backend(engine, XklXkb, cached_desc);
+
+	if (cached == NULL)
+		return FALSE;
+
+	switch (kev->any.xkb_type) {
+	case XkbControlsNotify:
+		return kev->ctrls.num_groups == cached->ctrls->num_groups;
+	case XkbNamesNotify:
+		return !(kev->names.changed &
+			 (XkbGroupNamesMask | XkbIndicatorNamesMask));
+	case XkbIndicatorMapNotify:
+		/* the names stay, just the changed maps are taken */
+		XkbGetIndicatorMap(kev->any.display,
+				   kev->indicators.changed, cached);
+		xkl_engine_backend(engine, XklXkb, server_state_tracked) =
+		    FALSE;
+		return TRUE;
+	}
+	return FALSE;
+}
+#endif
+
 /*
  * XKB event handler
  */
@@ -68,11 +101,38 @@ xkl_xkb_process_x_event(XklEngine * engine, XEvent * xev)
 		return xkl_xinput_process_x_event(engine, xev);
 #endif
 
+	/* the XKB events tell about everything the cached info depends on */
+	if (xev->type == MappingNotify) {
+		xkl_debug(200, "MappingNotify is left to the XKB events\n");
+		return 1;
+	}
+
 	if (xev->type != xkl_engine_backend(engine, XklXkb, event_type))
 		return 0;
 
 	xkl_debug(150, "Xkb event detected\n");
 
+	/* the events sent before the last fetch are already in the state */
+	if (kev->any.serial <
+	    xkl_engine_backend(engine, XklXkb, server_state_serial))
+		xkl_debug(160, "The event is older than the server state\n");
+	else if (kev->any.xkb_type == XkbStateNotify)
+		xkl_engine_backend(engine, XklXkb, server_state).group =
+		    kev->state.locked_group;
+	else if (kev->any.xkb_type == XkbIndicatorStateNotify) {
+		XkbDescPtr cached =
+		    xkl_engine_backend(engine, XklXkb, cached_desc);
+		/* no info until the postponed reload, ask the server then */
+		if (cached == NULL)
+			xkl_engine_backend(engine, XklXkb,
+					   server_state_tracked) = FALSE;
+		else
+			xkl_engine_backend(engine, XklXkb,
+					   server_state).indicators =
+			    kev->indicators.state &
+			    cached->indicators->phys_indicators;
+	}
+
 	switch (kev->any.xkb_type) {
 		/*
 		 * Group is changed!
@@ -135,6 +195,12 @@ xkl_xkb_process_x_event(XklEngine * engine, XEvent * xev)
 	case XkbIndicatorMapNotify:
 	case XkbControlsNotify:
 	case XkbNamesNotify:
+		if (xkl_xkb_config_event_is_noop(engine, kev)) {
+			xkl_debug(150, "%s does not change the config\n",
+				  xkl_xkb_event_get_name
+				  (kev->any.xkb_type));
+			break;
+		}
 #if 0
 		/* not really fair - but still better than flooding... */
 		XklDebug(200,
@@ -145,8 +211,11 @@ xkl_xkb_process_x_event(XklEngine * engine, XEvent * xev)
 	case XkbNewKeyboardNotify:
 		xkl_debug(150, "%s\n",
 			  xkl_xkb_event_get_name(kev->any.xkb_type));
-		xkl_engine_reset_all_info(engine, FALSE,
-					  "XKB event: XkbNewKeyboardNotify");
+		/* the indicators may differ, better ask */
+		xkl_engine_backend(engine, XklXkb, server_state_tracked) =
+		    FALSE;
+		xkl_engine_reset_all_info_deferred(engine, FALSE,
+						   "XKB event: XkbNewKeyboardNotify");
 		break;
 
 		/*
@@ -190,19 +259,22 @@ xkl_xkb_set_indicators(XklEngine * engine, const XklState * window_state)
 #ifdef LIBXKBFILE_PRESENT
 	int i;
 	unsigned bit;
+	XklXkbIndicatorChanges changes;
 
 	XkbDescPtr cached =
 	    xkl_engine_backend(engine, XklXkb, cached_desc);
+	xkl_xkb_indicator_changes_init(&changes);
 	ForPhysIndicators(i, bit) if (cached->names->indicators[i] != None) {
-		gboolean status;
-		status = xkl_xkb_set_indicator(engine, i,
-					       (window_state->indicators &
-						bit) != 0);
-		xkl_debug(150, "Set indicator \"%s\"/%d to %d: %d\n",
+		xkl_xkb_indicator_changes_add(engine, i,
+					      (window_state->indicators &
+					       bit) != 0, &changes);
+		xkl_debug(150, "Set indicator \"%s\"/%d to %d\n",
 			  xkl_engine_backend(engine, XklXkb,
 					     indicator_names)[i],
 			  cached->names->indicators[i],
-			  window_state->indicators & bit, status);
+			  window_state->indicators & bit);
 	}
+	/* all the indicators at once */
+	xkl_xkb_indicator_changes_apply(engine, &changes);
 #endif
 }
@@ -105,8 +105,8 @@ xkl_xmm_process_property_event(XklEngine * engine, XPropertyEvent * kpe)
 		 * Configuration is changed!
 		 */
 	if (kpe->atom == xkl_engine_priv(engine, base_config_atom)) {
-		xkl_engine_reset_all_info(engine, TRUE,
-					  "base config atom changed");
+		xkl_engine_reset_all_info_deferred(engine, TRUE,
+						   "base config atom changed");
 	}
 
 	return 0;
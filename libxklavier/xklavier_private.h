@@ -79,6 +79,30 @@ struct _XklEnginePrivate {
 
 	gboolean critical_section;
 
+	/*
+	 * The reset of the cached info requested by the configuration
+	 * events, postponed until the event queue drains
+	 */
+	gboolean reset_pending;
+
+	gboolean reset_pending_force;
+
+	/*
+	 * The idle source flushing the postponed reset, 0 if none
+	 */
+	guint reset_idle_id;
+
+	/*
+	 * How many resets were merged into the postponed ones
+	 */
+	guint suppressed_resets;
+
+	/*
+	 * Bumped on every reload of the cached info, before
+	 * "X-config-changed" is emitted
+	 */
+	guint config_generation;
+
 	Atom atoms[TOTAL_ATOMS];
 
 	Display *display;
@@ -93,6 +117,19 @@ struct _XklEnginePrivate {
 	 */
 	guint8 features;
 
+	/*
+	 * Whether the features are complete, see probe_features
+	 */
+	gboolean features_probed;
+
+	/*
+	 * Adds the features which are too costly to detect at startup,
+	 * called when the features are asked for the first time.
+	 * xkb: check whether the rules allow multiple layouts
+	 * xmodmap: NULL
+	 */
+	void (*probe_features) (XklEngine * engine);
+
 	/*
 	 * Activates the configuration.
 	 * xkb: create proper the XkbDescRec and send it to the server
@@ -101,6 +138,26 @@ struct _XklEnginePrivate {
 	 gboolean(*activate_config_rec) (XklEngine * engine,
 					 const XklConfigRec * data);
 
+	/*
+	 * Activates the configuration without blocking, NULL if the backend
+	 * can only do it synchronously.
+	 * xkb: compile the keymap in a thread, send it to the server after
+	 * xmodmap: NULL
+	 */
+	void (*activate_config_rec_async) (XklEngine * engine,
+					   const XklConfigRec * data,
+					   GCancellable * cancellable,
+					   GAsyncReadyCallback callback,
+					   gpointer user_data);
+
+	/*
+	 * Prepares the configuration for a quick activation later.
+	 * xkb: compile the keymap into the cache in the background
+	 * xmodmap: NULL
+	 */
+	 gboolean(*precompile_config_rec) (XklEngine * engine,
+					   const XklConfigRec * data);
+
 	/*
 	 * Background-specific initialization.
 	 * xkb: XkbInitAtoms - init internal xkb atoms table
@@ -128,6 +185,19 @@ struct _XklEnginePrivate {
 					      const XklConfigRec * data,
 					      const gboolean binary);
 
+	/*
+	 * Write many configurations into the files, NULL if the backend
+	 * can only write them one by one.
+	 * xkb: compile the keymaps in parallel, write them as they come
+	 * xmodmap: NULL
+	 */
+	 guint(*write_config_rec_to_files) (XklEngine * engine,
+					    XklConfigRecExportJob * jobs,
+					    guint n_jobs,
+					    guint max_processes,
+					    XklConfigRecExportFunc func,
+					    gpointer data);
+
 	/*
 	 * Get the list of the group names
 	 * xkb: return cached list of the group names
@@ -267,11 +337,146 @@ struct _XklEnginePrivate {
 
 extern XklEngine *xkl_get_the_engine(void);
 
+/*
+ * The registry item, as stored in the in-memory index.
+ * All the strings belong to the index.
+ */
+typedef struct {
+	const gchar *name;
+	const gchar *short_description;
+	const gchar *description;
+	const gchar *vendor;
+	const gchar **countries;
+	const gchar **languages;
+	gboolean extra;
+	/* option groups only */
+	gboolean allow_multiple_selection;
+
+	/* layout of the variant, group of the option; -1 for others */
+	gint parent;
+	/* variants of the layout, options of the group; -1 if none */
+	gint first_child;
+	gint last_child;
+	/* next variant of the same layout, option of the same group */
+	gint next_sibling;
+} XklConfigIndexItem;
+
+/*
+ * What the search by pattern checks for a layout or a variant,
+ * as ids of the texts in XklConfigSearchData
+ */
+typedef struct {
+	/* description; "layout - variant" for the variants */
+	guint description;
+	/* in XklConfigSearchData.names: country names, then language names */
+	guint first_name;
+	guint n_countries;
+	guint n_languages;
+} XklConfigSearchEntry;
+
+typedef struct {
+	/* upper-cased NUL-terminated texts, back to back */
+	GString *text;
+	/* text ids of the country and language names */
+	GArray *names;
+	/* one per layout, then one per variant */
+	GArray *entries;
+
+	/* offsets of the texts in text, by text id */
+	GArray *text_offsets;
+
+	/*
+	 * Fuzzy search vocabulary, NULL till the first fuzzy search:
+	 * distinct words as UCS-4 (words, word_offsets) and the word ids
+	 * of every text (text_words, from text_first_words[id]
+	 * to text_first_words[id + 1])
+	 */
+	GArray *words;
+	GArray *word_offsets;
+	GArray *text_words;
+	GArray *text_first_words;
+} XklConfigSearchData;
+
+typedef struct {
+	/* upper-cased words of the pattern */
+	gchar **needles;
+	/*
+	 * Fuzzy search only: for every needle, a flag per vocabulary word
+	 * telling whether the word is close enough
+	 */
+	guint8 *word_matches;
+} XklConfigSearchQuery;
+
+/*
+ * In-memory tables, built from the registry documents on load.
+ * The items from all the documents are merged, in the document order.
+ */
+typedef struct {
+	GArray *models;
+	GArray *layouts;
+	GArray *variants;
+	GArray *option_groups;
+	GArray *options;
+
+	/* name -> index + 1 */
+	GHashTable *layouts_by_name;
+	GHashTable *option_groups_by_name;
+
+	GStringChunk *strings;
+	GPtrArray *lists;
+
+	/*
+	 * ISO code -> translated name, for the codes the registry refers to.
+	 * NULL unless read from a snapshot, the iso-codes are asked then.
+	 */
+	GHashTable *country_names;
+	GHashTable *language_names;
+
+	/* the snapshot the strings point into, if any */
+	GMappedFile *snapshot;
+
+	/* NULL till the first search */
+	XklConfigSearchData *search;
+} XklConfigIndex;
+
+#define xkl_config_index_item(index,table,i) \
+  (&g_array_index((index)->table, XklConfigIndexItem, (i)))
+
+typedef void (*XklConfigIndexFillFunc) (const XklConfigIndexItem * iitem,
+					XklConfigItem * item);
+
+/* see xkl_config_registry_get_stat() */
+typedef struct {
+	guint count;
+	gint64 usec;
+} XklConfigRegistryStatCounter;
+
 struct _XklConfigRegistryPrivate {
 	XklEngine *engine;
 
 	xmlDocPtr docs[XKL_NUMBER_OF_REGISTRY_DOCS];
 	xmlXPathContextPtr xpath_contexts[XKL_NUMBER_OF_REGISTRY_DOCS];
+	/* the files the documents were read from, NULL for other sources */
+	gchar *doc_files[XKL_NUMBER_OF_REGISTRY_DOCS];
+
+	/*
+	 * Registry items for the groups of the current configuration,
+	 * one element per group (NULL if the item is not in the registry).
+	 * Resolved on first use, NULL when not resolved yet. Stale once
+	 * the config_generation of the engine moves on.
+	 */
+	GPtrArray *group_layout_items;
+	GPtrArray *group_variant_items;
+	guint group_items_generation;
+
+	XklConfigIndex *index;
+
+	/* for the search by pattern, 0 means "one per processor" */
+	gint max_search_threads;
+	/* the threads of the parallel search, started by the first one */
+	GThreadPool *search_pool;
+
+	XklConfigRegistryStatCounter stats[XKL_CONFIG_REGISTRY_NUM_STATS];
 };
 
 extern void xkl_engine_ensure_vtable_inited(XklEngine * engine);
@@ -297,6 +502,11 @@ extern Window xkl_engine_get_registered_parent(XklEngine * engine,
 					       Window win);
 extern void xkl_engine_reset_all_info(XklEngine * engine, gboolean force,
 				      const gchar reason[]);
+extern void xkl_engine_reset_all_info_deferred(XklEngine * engine,
+					       gboolean force,
+					       const gchar reason[]);
+extern void xkl_engine_reset_all_info_if_idle(XklEngine * engine);
+extern void xkl_engine_flush_pending_reset(XklEngine * engine);
 extern gboolean xkl_engine_load_window_tree(XklEngine * engine);
 extern gboolean xkl_engine_load_subtree(XklEngine * engine, Window window,
 					gint level, XklState * init_state);
@@ -394,6 +604,8 @@ extern void xkl_config_rec_split_options(XklConfigRec * data,
 
 extern void xkl_config_rec_dump(FILE * file, XklConfigRec * data);
 
+extern void xkl_config_rec_activation_return(GTask * task, gboolean rv);
+
 extern const gchar *xkl_event_get_name(gint type);
 
 extern void xkl_engine_update_current_state(XklEngine * engine, gint group,
@@ -415,6 +627,16 @@ extern gboolean xkl_config_registry_load_from_file(XklConfigRegistry *
 						   const gchar * file_name,
 						   gint docidx);
 
+extern gboolean xkl_config_registry_load_from_fd_doc(XklConfigRegistry *
+						     config, gint fd,
+						     gint docidx);
+
+extern gboolean xkl_config_registry_load_from_memory(XklConfigRegistry *
+						     config,
+						     gconstpointer data,
+						     gsize size,
+						     gint docidx);
+
 extern void xkl_config_registry_free(XklConfigRegistry * config);
 
 extern gchar *xkl_locale_from_utf8(XklConfigRegistry * config,
@@ -438,7 +660,8 @@ extern gboolean xkl_config_registry_load_helper(XklConfigRegistry * config, cons
 #define xkl_engine_vcall(engine,func)  (*(engine)->priv->func)
 
 #define xkl_config_registry_is_initialized(config) \
-  ( xkl_config_registry_priv(config,xpath_contexts[0]) != NULL )
+  ( xkl_config_registry_priv(config,xpath_contexts[0]) != NULL || \
+    xkl_config_registry_priv(config,index) != NULL )
 
 #define xkl_config_registry_priv(config,member)  (config)->priv->member
 #define xkl_config_registry_get_engine(config) ((config)->priv->engine)
@@ -457,28 +680,77 @@ extern gboolean xkl_config_registry_load_helper(XklConfigRegistry * config, cons
 #define XML_TAG_ISO3166ID "iso3166Id"
 #define XML_TAG_ISO639ID "iso639Id"
 
-extern void
+#define ISO_CODES_DATADIR    ISO_CODES_PREFIX "/share/xml/iso-codes"
+#define ISO_CODES_LOCALESDIR ISO_CODES_PREFIX "/share/locale"
+
+/* gettext domain for translations */
+#define XKB_DOMAIN "xkeyboard-config"
+
+extern gboolean xkl_read_config_item(XklConfigRegistry * config,
+				     gint doc_index, xmlNodePtr iptr,
+				     XklConfigItem * item);
 
+extern XklConfigIndex *xkl_config_index_new(XklConfigRegistry * config);
 
+extern XklConfigIndex *xkl_config_index_new_empty(void);
 
+extern void xkl_config_index_free(XklConfigIndex * index);
 
+extern gint xkl_config_index_find_layout(XklConfigIndex * index,
+					 const gchar * name);
 
-xkl_config_registry_foreach_in_xpath_with_param(XklConfigRegistry * config,
-						const gchar * format,
-						const gchar * value,
-						XklConfigItemProcessFunc func,
-						gpointer data);
+extern gint xkl_config_index_find_option_group(XklConfigIndex * index,
+					       const gchar * name);
 
-extern void xkl_config_registry_foreach_in_xpath(XklConfigRegistry *
-						 config,
-						 xmlXPathCompExprPtr
-						 xpath_comp_expr,
-						 XklConfigItemProcessFunc
-						 func, gpointer data);
+extern void xkl_config_index_item_fill(const XklConfigIndexItem * iitem,
+				       XklConfigItem * item);
 
-extern gboolean xkl_read_config_item(XklConfigRegistry * config,
-				     gint doc_index, xmlNodePtr iptr,
-				     XklConfigItem * item);
+extern void xkl_config_index_group_fill(const XklConfigIndexItem * iitem,
+					XklConfigItem * item);
+
+extern const gchar *xkl_config_index_get_country_name(XklConfigIndex *
+						      index,
+						      const gchar * code);
+
+extern const gchar *xkl_config_index_get_language_name(XklConfigIndex *
+						       index,
+						       const gchar * code);
+
+/* NULL if no snapshot fits the translations asked for */
+extern gchar *xkl_config_registry_get_snapshot_name(const gchar * dir,
+						    const gchar * ruleset,
+						    gboolean
+						    if_extras_needed);
+
+extern gboolean xkl_config_registry_load_snapshot_for(XklConfigRegistry *
+						      config,
+						      const gchar *
+						      file_name,
+						      const gchar *
+						      doc_files[]);
+
+extern void xkl_config_registry_stat_add(XklConfigRegistry * config,
+					 XklConfigRegistryStat stat,
+					 gint64 start);
+
+extern XklConfigSearchData
+    *xkl_config_index_get_search_data(XklConfigIndex * index);
+
+extern void xkl_config_search_data_free(XklConfigSearchData * search);
+
+extern void xkl_config_search_layout(const XklConfigIndex * index,
+				     guint layout,
+				     const XklConfigSearchQuery * query,
+				     guint8 * matches);
+
+extern void xkl_config_search_deliver(XklConfigRegistry * config,
+				      const XklConfigIndex * index,
+				      guint layout,
+				      const guint8 * matches,
+				      XklConfigItem * layout_ci,
+				      XklConfigItem * variant_ci,
+				      XklTwoConfigItemsProcessFunc func,
+				      gpointer data);
 
 extern gint xkl_debug_level;
 
@@ -44,8 +44,23 @@ typedef struct _XklXkb {
 
 	gchar *group_names[XkbNumKbdGroups];
 
+	/*
+	 * The names of the atoms ever resolved, the names above point here
+	 */
+	GHashTable *atom_names;
+
 	int device_id;
 
+	/*
+	 * The server state, kept up to date by the events while tracked.
+	 * The events older than the last fetch (by serial) are ignored.
+	 */
+	XklState server_state;
+
+	gboolean server_state_tracked;
+
+	unsigned long server_state_serial;
+
 #ifdef HAVE_XINPUT
 	gint xi_event_type;
 
@@ -70,14 +85,54 @@ extern void xkl_xkb_config_native_cleanup(XklEngine * engine,
 					  XkbComponentNamesPtr
 					  component_names);
 
-extern gboolean xkl_xkb_set_indicator(XklEngine * engine,
-				      gint indicator_num, gboolean set);
+extern void xkl_xkb_rules_cache_free(void);
+
+extern void xkl_xkb_precompile_free(void);
+
+/*
+ * The indicator changes which can be sent together
+ */
+typedef struct {
+	guint affect_ctrls;
+	guint enabled_ctrls;
+	gint lock_group;
+	gint latch_group;
+	guint lock_affect;
+	guint lock_mods;
+	guint latch_affect;
+	guint latch_mods;
+} XklXkbIndicatorChanges;
+
+extern void xkl_xkb_indicator_changes_init(XklXkbIndicatorChanges *
+					   changes);
+
+extern void xkl_xkb_indicator_changes_add(XklEngine * engine,
+					  gint indicator_num, gboolean set,
+					  XklXkbIndicatorChanges * changes);
+
+extern void xkl_xkb_indicator_changes_apply(XklEngine * engine,
+					    XklXkbIndicatorChanges *
+					    changes);
+
+extern void xkl_xkb_get_atom_names(XklEngine * engine, Atom * atoms,
+				   gint n, const gchar ** names_out);
 
 /* Start VTable methods */
 
+extern void xkl_xkb_probe_features(XklEngine * engine);
+
 extern gboolean xkl_xkb_activate_config_rec(XklEngine * engine,
 					    const XklConfigRec * data);
 
+extern void xkl_xkb_activate_config_rec_async(XklEngine * engine,
+					      const XklConfigRec * data,
+					      GCancellable * cancellable,
+					      GAsyncReadyCallback callback,
+					      gpointer user_data);
+
+extern gboolean xkl_xkb_precompile_config_rec(XklEngine * engine,
+					      const XklConfigRec * data);
+
 extern void xkl_xkb_init_config_registry(XklConfigRegistry * config);
 
 extern gboolean xkl_xkb_load_config_registry(XklConfigRegistry * config,
@@ -88,6 +143,13 @@ extern gboolean xkl_xkb_write_config_rec_to_file(XklEngine * engine,
 						 const XklConfigRec * data,
 						 const gboolean binary);
 
+extern guint xkl_xkb_write_config_rec_to_files(XklEngine * engine,
+					       XklConfigRecExportJob * jobs,
+					       guint n_jobs,
+					       guint max_processes,
+					       XklConfigRecExportFunc func,
+					       gpointer data);
+
 extern gint xkl_xkb_process_x_event(XklEngine * engine, XEvent * xev);
 
 extern gint xkl_xkb_process_x_error(XklEngine * engine, XErrorEvent * xerev);
@@ -100,6 +162,8 @@ extern guint xkl_xkb_get_max_num_groups(XklEngine * engine);
 
 extern guint xkl_xkb_get_num_groups(XklEngine * engine);
 
+extern gboolean xkl_xkb_is_server_state_tracked(XklEngine * engine);
+
 extern void xkl_xkb_get_server_state(XklEngine * engine,
 				     XklState * current_state_out);
 
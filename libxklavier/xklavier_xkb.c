@@ -51,6 +51,7 @@ xkl_xkb_get_indicators_names(XklEngine * engine)
 gint
 xkl_xkb_pause_listen(XklEngine * engine)
 {
+	xkl_engine_backend(engine, XklXkb, server_state_tracked) = FALSE;
 	XkbSelectEvents(xkl_engine_get_display(engine),
 			xkl_engine_backend(engine, XklXkb, device_id),
 			XkbAllEventsMask, 0);
@@ -74,12 +75,14 @@ xkl_xkb_resume_listen(XklEngine * engine)
           XkbNewKeyboardNotifyMask)
 
 	Display *display = xkl_engine_get_display(engine);
+	/* the state is fetched again after the events are selected */
+	xkl_engine_backend(engine, XklXkb, server_state_tracked) = FALSE;
 	XkbSelectEvents(display,
 			xkl_engine_backend(engine, XklXkb, device_id),
 			XKB_EVT_MASK, XKB_EVT_MASK);
 
 #define XKB_STATE_EVT_DTL_MASK \
-         (XkbGroupStateMask)
+         (XkbGroupStateMask|XkbGroupLockMask)
 
 	XkbSelectEventDetails(display,
 			      xkl_engine_backend(engine, XklXkb,
@@ -108,12 +111,19 @@ xkl_xkb_resume_listen(XklEngine * engine)
 	return 0;
 }
 
+void
+xkl_xkb_probe_features(XklEngine * engine)
+{
+	if (xkl_xkb_multiple_layouts_supported(engine))
+		xkl_engine_priv(engine, features) |=
+		    XKLF_MULTIPLE_LAYOUTS_SUPPORTED;
+}
+
 guint
 xkl_xkb_get_max_num_groups(XklEngine * engine)
 {
-	return xkl_engine_priv(engine,
-			       features) & XKLF_MULTIPLE_LAYOUTS_SUPPORTED
-	    ? XkbNumKbdGroups : 1;
+	return xkl_engine_get_features(engine) &
+	    XKLF_MULTIPLE_LAYOUTS_SUPPORTED ? XkbNumKbdGroups : 1;
 }
 
 guint
@@ -133,25 +143,16 @@ xkl_xkb_get_num_groups(XklEngine * engine)
 void
 xkl_xkb_free_all_info(XklEngine * engine)
 {
-	gint i;
-	gchar **pi = xkl_engine_backend(engine, XklXkb, indicator_names);
 	XkbDescPtr desc;
 
-	for (i = 0; i < XkbNumIndicators; i++, pi++) {
-		/* only free non-empty ones */
-		if (*pi && **pi)
-			XFree(*pi);
-	}
+	/* the names belong to the atom names cache */
+	memset(xkl_engine_backend(engine, XklXkb, indicator_names), 0,
+	       sizeof(xkl_engine_backend(engine, XklXkb, indicator_names)));
+	memset(xkl_engine_backend(engine, XklXkb, group_names), 0,
+	       sizeof(xkl_engine_backend(engine, XklXkb, group_names)));
+
 	desc = xkl_engine_backend(engine, XklXkb, cached_desc);
 	if (desc != NULL) {
-		int i;
-		char **group_name =
-		    xkl_engine_backend(engine, XklXkb, group_names);
-		for (i = desc->ctrls->num_groups; --i >= 0; group_name++)
-			if (*group_name) {
-				XFree(*group_name);
-				*group_name = NULL;
-			}
 		XkbFreeKeyboard(desc, XkbAllComponentsMask, True);
 		xkl_engine_backend(engine, XklXkb, cached_desc) = NULL;
 	}
@@ -249,14 +250,67 @@ xkl_xkb_if_cached_info_equals_actual(XklEngine * engine)
 	return rv;
 }
 
+/*
+ * Resolves the atoms with one request at most. The server never frees
+ * the atoms, so the names are kept for the life of the engine.
+ * The names of None (and of the unknown atoms) are NULL.
+ */
+void
+xkl_xkb_get_atom_names(XklEngine * engine, Atom * atoms, gint n,
+		       const gchar ** names_out)
+{
+	GHashTable *cache = xkl_engine_backend(engine, XklXkb, atom_names);
+	Atom *missing = g_new(Atom, n);
+	char **missing_names = g_new0(char *, n);
+	gint i, n_missing = 0;
+
+	if (cache == NULL)
+		cache = xkl_engine_backend(engine, XklXkb, atom_names) =
+		    g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					  NULL, g_free);
+
+	for (i = 0; i < n; i++) {
+		names_out[i] = atoms[i] == None ? NULL :
+		    g_hash_table_lookup(cache, GUINT_TO_POINTER(atoms[i]));
+		if (atoms[i] != None && names_out[i] == NULL)
+			missing[n_missing++] = atoms[i];
+	}
+
+	if (n_missing > 0) {
+		xkl_debug(200, "Resolving %d atoms\n", n_missing);
+		/* fails if any atom is bad, the rest is still there */
+		XGetAtomNames(xkl_engine_get_display(engine), missing,
+			      n_missing, missing_names);
+		for (i = 0; i < n_missing; i++)
+			if (missing_names[i] != NULL) {
+				g_hash_table_insert(cache,
+						    GUINT_TO_POINTER(missing
+								     [i]),
+						    g_strdup(missing_names
+							     [i]));
+				XFree(missing_names[i]);
+			}
+		for (i = 0; i < n; i++)
+			if (atoms[i] != None && names_out[i] == NULL)
+				names_out[i] =
+				    g_hash_table_lookup(cache,
+							GUINT_TO_POINTER
+							(atoms[i]));
+	}
+
+	g_free(missing_names);
+	g_free(missing);
+}
+
 /*
  * Load some XKB parameters
  */
 gboolean
 xkl_xkb_load_all_info(XklEngine * engine)
 {
-	gint i;
-	Atom *pa;
+	gint i, n_groups;
+	Atom atoms[XkbNumKbdGroups + XkbNumIndicators];
+	const gchar *names[XkbNumKbdGroups + XkbNumIndicators];
 	gchar **group_name;
 	gchar **pi = xkl_engine_backend(engine, XklXkb, indicator_names);
 	Display *display = xkl_engine_get_display(engine);
@@ -277,18 +331,8 @@ xkl_xkb_load_all_info(XklEngine * engine)
 	xkl_engine_backend(engine, XklXkb, actual_desc) = NULL;
 
 	/* First, output the number of the groups */
-	xkl_debug(200, "found %d groups\n", cached->ctrls->num_groups);
-
-	/* Then, cache (and output) the names of the groups */
-	pa = cached->names->groups;
-	group_name = xkl_engine_backend(engine, XklXkb, group_names);
-	for (i = cached->ctrls->num_groups; --i >= 0; pa++, group_name++) {
-		*group_name =
-		    XGetAtomName(display,
-				 *pa == None ? XInternAtom(display, "-",
-							   False) : *pa);
-		xkl_debug(200, "Group %d has name [%s]\n", i, *group_name);
-	}
+	n_groups = cached->ctrls->num_groups;
+	xkl_debug(200, "found %d groups\n", n_groups);
 
 	xkl_engine_priv(engine, last_error_code) =
 	    XkbGetIndicatorMap(display, XkbAllIndicatorsMask, cached);
@@ -298,15 +342,24 @@ xkl_xkb_load_all_info(XklEngine * engine)
 		return FALSE;
 	}
 
-	/* Then, cache (and output) the names of the indicators */
-	pa = cached->names->indicators;
-	for (i = XkbNumIndicators; --i >= 0; pi++, pa++) {
-		Atom a = *pa;
-		if (a != None)
-			*pi = XGetAtomName(display, a);
-		else
-			*pi = "";
+	/* All the names at once, the known ones are not even asked for */
+	memcpy(atoms, cached->names->groups, n_groups * sizeof(Atom));
+	memcpy(atoms + n_groups, cached->names->indicators,
+	       XkbNumIndicators * sizeof(Atom));
+	xkl_xkb_get_atom_names(engine, atoms, n_groups + XkbNumIndicators,
+			       names);
 
+	/* Then, cache (and output) the names of the groups */
+	group_name = xkl_engine_backend(engine, XklXkb, group_names);
+	for (i = 0; i < n_groups; i++, group_name++) {
+		*group_name = (gchar *) (names[i] != NULL ? names[i] : "-");
+		xkl_debug(200, "Group %d has name [%s]\n", i, *group_name);
+	}
+
+	/* Then, cache (and output) the names of the indicators */
+	for (i = 0; i < XkbNumIndicators; i++, pi++) {
+		*pi = (gchar *) (names[n_groups + i] != NULL ?
+				 names[n_groups + i] : "");
 		xkl_debug(200, "Indicator[%d] is %s\n", i, *pi);
 	}
 
@@ -327,16 +380,40 @@ xkl_xkb_lock_group(XklEngine * engine, gint group)
 	XkbLockGroup(display,
 		     xkl_engine_backend(engine, XklXkb, device_id), group);
 	XSync(display, False);
+	/* the event comes later, until then the server knows better */
+	xkl_engine_backend(engine, XklXkb, server_state_tracked) = FALSE;
+}
+
+/* Whether the state comes from the XKB events, with no round trip */
+gboolean
+xkl_xkb_is_server_state_tracked(XklEngine * engine)
+{
+	return xkl_engine_backend(engine, XklXkb, server_state_tracked)
+	    && (xkl_engine_is_listening_for(engine,
+					    XKLL_MANAGE_WINDOW_STATES)
+		|| xkl_engine_is_listening_for(engine,
+					       XKLL_TRACK_KEYBOARD_STATE));
 }
 
 /*
- * Updates current internal state from X state
+ * Updates current internal state from X state.
+ * While the XKB events are processed, the state is taken from them.
  */
 void
 xkl_xkb_get_server_state(XklEngine * engine, XklState * current_state_out)
 {
 	XkbStateRec state;
 	Display *display = xkl_engine_get_display(engine);
+	XkbDescPtr cached = xkl_engine_backend(engine, XklXkb, cached_desc);
+
+	if (xkl_xkb_is_server_state_tracked(engine)) {
+		*current_state_out =
+		    xkl_engine_backend(engine, XklXkb, server_state);
+		return;
+	}
+
+	xkl_engine_backend(engine, XklXkb, server_state_serial) =
+	    NextRequest(display);
 
 	current_state_out->group = 0;
 	if (Success ==
@@ -349,20 +426,69 @@ xkl_xkb_get_server_state(XklEngine * engine, XklState * current_state_out)
 	    XkbGetIndicatorState(display,
 				 xkl_engine_backend(engine, XklXkb,
 						    device_id),
-				 &current_state_out->indicators))
-		current_state_out->indicators &=
-		    xkl_engine_backend(engine, XklXkb,
-				       cached_desc)->indicators->
-		    phys_indicators;
-	else
+				 &current_state_out->indicators)) {
+		/* without the cached description the value stays unmasked */
+		if (cached != NULL)
+			current_state_out->indicators &=
+			    cached->indicators->phys_indicators;
+	} else
 		current_state_out->indicators = 0;
+
+	/* the events cannot be followed until the info is reloaded */
+	xkl_engine_backend(engine, XklXkb, server_state) =
+	    *current_state_out;
+	xkl_engine_backend(engine, XklXkb, server_state_tracked) =
+	    cached != NULL;
+}
+
+void
+xkl_xkb_indicator_changes_init(XklXkbIndicatorChanges * changes)
+{
+	memset(changes, 0, sizeof(*changes));
+	changes->latch_group = -1;
+	changes->lock_group = -1;
 }
 
 /*
- * Actually taken from mxkbledpanel, valueChangedProc
+ * Sends the collected indicator changes with a single request of each
+ * kind, and no sync - just a flush
  */
-gboolean
-xkl_xkb_set_indicator(XklEngine * engine, gint indicator_num, gboolean set)
+void
+xkl_xkb_indicator_changes_apply(XklEngine * engine,
+				XklXkbIndicatorChanges * changes)
+{
+	Display *display = xkl_engine_get_display(engine);
+	int device_id = xkl_engine_backend(engine, XklXkb, device_id);
+
+	if (changes->affect_ctrls)
+		XkbChangeEnabledControls(display, device_id,
+					 changes->affect_ctrls,
+					 changes->enabled_ctrls);
+	if (changes->lock_group != -1)
+		XkbLockGroup(display, device_id, changes->lock_group);
+	if (changes->latch_group != -1)
+		XkbLatchGroup(display, device_id, changes->latch_group);
+	if (changes->lock_affect)
+		XkbLockModifiers(display, device_id, changes->lock_affect,
+				 changes->lock_mods);
+	if (changes->latch_affect)
+		XkbLatchModifiers(display, device_id,
+				  changes->latch_affect,
+				  changes->latch_mods);
+	XFlush(display);
+
+	/* the event comes later, until then the server knows better */
+	xkl_engine_backend(engine, XklXkb, server_state_tracked) = FALSE;
+}
+
+/*
+ * Actually taken from mxkbledpanel, valueChangedProc.
+ * The explicit LEDs are set right away, the rest is collected
+ */
+void
+xkl_xkb_indicator_changes_add(XklEngine * engine, gint indicator_num,
+			      gboolean set,
+			      XklXkbIndicatorChanges * changes)
 {
 	XkbIndicatorMapPtr map;
 	Display *display = xkl_engine_get_display(engine);
@@ -390,7 +516,7 @@ xkl_xkb_set_indicator(XklEngine * engine, gint indicator_num, gboolean set)
 	case XkbIM_NoExplicit | XkbIM_NoAutomatic:
 		{
 			/* Can do nothing. Just ignore the indicator */
-			return TRUE;
+			return;
 		}
 
 	case XkbIM_NoAutomatic:
@@ -413,10 +539,9 @@ xkl_xkb_set_indicator(XklEngine * engine, gint indicator_num, gboolean set)
 				XChangeKeyboardControl(display,
 						       KBLed | KBLedMode,
 						       &xkc);
-				XSync(display, False);
 			}
 
-			return TRUE;
+			return;
 		}
 
 	case XkbIM_NoExplicit:
@@ -434,13 +559,12 @@ xkl_xkb_set_indicator(XklEngine * engine, gint indicator_num, gboolean set)
 	if (map->ctrls) {
 		gulong which = map->ctrls;
 
-		XkbGetControls(display, XkbAllControlsMask, cached);
+		/* only these controls are affected, no need to fetch all */
+		changes->affect_ctrls |= which;
 		if (set)
-			cached->ctrls->enabled_ctrls |= which;
+			changes->enabled_ctrls |= which;
 		else
-			cached->ctrls->enabled_ctrls &= ~which;
-		XkbSetControls(display, which | XkbControlsEnabledMask,
-			       cached);
+			changes->enabled_ctrls &= ~which;
 	}
 
 	/* The 'which_groups' field tells when this indicator turns on
@@ -467,14 +591,10 @@ xkl_xkb_set_indicator(XklEngine * engine, gint indicator_num, gboolean set)
 				/* Important: Groups should be ignored here - because they are handled separately! */
 				/* XklLockGroup( group ); */
 			} else if (map->which_groups & XkbIM_UseLatched)
-				XkbLatchGroup(display,
-					      xkl_engine_backend(engine,
-								 XklXkb,
-								 device_id),
-					      group);
+				changes->latch_group = group;
 			else {
 				/* Can do nothing. Just ignore the indicator */
-				return TRUE;
+				return;
 			}
 		} else
 			/* Turning off a group indicator will mean that we just
@@ -486,7 +606,7 @@ xkl_xkb_set_indicator(XklEngine * engine, gint indicator_num, gboolean set)
 					group = i;
 					break;
 				}
-			xkl_xkb_lock_group(engine, group);
+			changes->lock_group = group;
 		}
 	}
 
@@ -512,22 +632,16 @@ xkl_xkb_set_indicator(XklEngine * engine, gint indicator_num, gboolean set)
 		mods = set ? affect : 0;
 
 		if (map->which_mods &
-		    (XkbIM_UseLocked | XkbIM_UseEffective))
-			XkbLockModifiers(display,
-					 xkl_engine_backend(engine, XklXkb,
-							    device_id),
-					 affect, mods);
-		else if (map->which_mods & XkbIM_UseLatched)
-			XkbLatchModifiers(display,
-					  xkl_engine_backend(engine,
-							     XklXkb,
-							     device_id),
-					  affect, mods);
-		else {
-			return TRUE;
+		    (XkbIM_UseLocked | XkbIM_UseEffective)) {
+			changes->lock_affect |= affect;
+			changes->lock_mods =
+			    (changes->lock_mods & ~affect) | mods;
+		} else if (map->which_mods & XkbIM_UseLatched) {
+			changes->latch_affect |= affect;
+			changes->latch_mods =
+			    (changes->latch_mods & ~affect) | mods;
 		}
 	}
-	return TRUE;
 }
 
 #endif
@@ -546,14 +660,21 @@ xkl_xkb_init(XklEngine * engine)
 	xkl_engine_priv(engine, features) = XKLF_CAN_TOGGLE_INDICATORS |
 	    XKLF_CAN_OUTPUT_CONFIG_AS_ASCII |
 	    XKLF_CAN_OUTPUT_CONFIG_AS_BINARY;
+	xkl_engine_priv(engine, probe_features) = xkl_xkb_probe_features;
 	xkl_engine_priv(engine, activate_config_rec) =
 	    xkl_xkb_activate_config_rec;
+	xkl_engine_priv(engine, activate_config_rec_async) =
+	    xkl_xkb_activate_config_rec_async;
+	xkl_engine_priv(engine, precompile_config_rec) =
+	    xkl_xkb_precompile_config_rec;
 	xkl_engine_priv(engine, init_config_registry) =
 	    xkl_xkb_init_config_registry;
 	xkl_engine_priv(engine, load_config_registry) =
 	    xkl_xkb_load_config_registry;
 	xkl_engine_priv(engine, write_config_rec_to_file) =
 	    xkl_xkb_write_config_rec_to_file;
+	xkl_engine_priv(engine, write_config_rec_to_files) =
+	    xkl_xkb_write_config_rec_to_files;
 	xkl_engine_priv(engine, get_groups_names) =
 	    xkl_xkb_get_groups_names;
 	xkl_engine_priv(engine, get_indicators_names) =
@@ -608,12 +729,8 @@ xkl_xkb_init(XklEngine * engine)
 	xkl_engine_priv(engine, default_model) = "pc101";
 	xkl_engine_priv(engine, default_layout) = "us";
 
-	/* First, we have to assign xkl_vtable - 
-	   because this function uses it */
-
-	if (xkl_xkb_multiple_layouts_supported(engine))
-		xkl_engine_priv(engine, features) |=
-		    XKLF_MULTIPLE_LAYOUTS_SUPPORTED;
+	/* the support of multiple layouts is probed on demand,
+	   it takes loading the rules */
 
 #if HAVE_XINPUT
 	if (XQueryExtension
@@ -656,6 +773,15 @@ xkl_xkb_init(XklEngine * engine)
 void
 xkl_xkb_term(XklEngine * engine)
 {
+#ifdef LIBXKBFILE_PRESENT
+	xkl_xkb_precompile_free();
+	xkl_xkb_rules_cache_free();
+#endif
+	if (xkl_engine_backend(engine, XklXkb, atom_names) != NULL) {
+		g_hash_table_destroy(xkl_engine_backend
+				     (engine, XklXkb, atom_names));
+		xkl_engine_backend(engine, XklXkb, atom_names) = NULL;
+	}
 }
 
 #ifdef LIBXKBFILE_PRESENT
@@ -309,13 +309,17 @@ xkl_xmm_init(XklEngine * engine)
 	xkl_engine_priv(engine, features) =
 	    XKLF_MULTIPLE_LAYOUTS_SUPPORTED |
 	    XKLF_REQUIRES_MANUAL_LAYOUT_MANAGEMENT;
+	xkl_engine_priv(engine, probe_features) = NULL;
 	xkl_engine_priv(engine, activate_config_rec) =
 	    xkl_xmm_activate_config_rec;
+	xkl_engine_priv(engine, activate_config_rec_async) = NULL;
+	xkl_engine_priv(engine, precompile_config_rec) = NULL;
 	xkl_engine_priv(engine, init_config_registry) =
 	    xkl_xmm_init_config_registry;
 	xkl_engine_priv(engine, load_config_registry) =
 	    xkl_xmm_load_config_registry;
 	xkl_engine_priv(engine, write_config_rec_to_file) = NULL;
+	xkl_engine_priv(engine, write_config_rec_to_files) = NULL;
 
 	xkl_engine_priv(engine, get_groups_names) =
 	    xkl_xmm_get_groups_names;
@@ -33,14 +33,16 @@
 extern void xkl_config_rec_dump(FILE * file, XklConfigRec * data);
 
 enum { ACTION_NONE, ACTION_LIST, ACTION_GET, ACTION_SET,
-	ACTION_WRITE, ACTION_SEARCH
+	ACTION_WRITE, ACTION_SEARCH, ACTION_FILTER, ACTION_BENCHMARK,
+	ACTION_FUZZY_SEARCH, ACTION_VALIDATE, ACTION_EXPORT,
+	ACTION_ASYNC_SET
 };
 
 static void
 print_usage(void)
 {
 	printf
-	    ("Usage: test_config (-g)|(-s -m <model> -l <layouts> -o <options>)|(-h)|(-ws)|(-wb)(-d <debugLevel>)|(-p pattern)\n");
+	    ("Usage: test_config (-g)|(-s -m <model> -l <layouts> -o <options>)|(-y -m <model> -l <layouts> -o <options>)|(-v -m <model> -l <layouts> -o <options>)|(-h)|(-ws)|(-wb)|(-e)(-d <debugLevel>)|(-p pattern)|(-f language)|(-b pattern)|(-z pattern)\n");
 	printf("Options:\n");
 	printf("         -al - list all available layouts and variants\n");
 	printf("         -am - list all available models\n");
@@ -52,12 +54,26 @@ print_usage(void)
 	    ("         -g - Dump the current config, load original system settings and revert back\n");
 	printf
 	    ("         -s - Set the configuration given my -m -l -o options. Similar to setxkbmap\n");
+	printf
+	    ("         -y - Set the configuration given by -m -l -o options, asynchronously\n");
+	printf
+	    ("         -v - Validate the configuration given by -m -l -o options, no display needed\n");
 	printf("         -ws - Write the binary XKB config file (" PACKAGE
 	       ".xkm)\n");
 	printf("         -wb - Write the source XKB config file (" PACKAGE
 	       ".xkb)\n");
+	printf
+	    ("         -e - Write both XKB config files (" PACKAGE
+	     ".xkm and " PACKAGE ".xkb) in one batch\n");
 	printf("         -d - Set the debug level (by default, 0)\n");
 	printf("         -p - Search by pattern\n");
+	printf("         -z - Search by pattern, tolerating typos\n");
+	printf
+	    ("         -f - List non-extra variants for the ISO language code\n");
+	printf
+	    ("         -b - Time the search by pattern with 1..N threads\n");
+	printf
+	    ("         -r - Load the registry from the given (possibly compressed) file\n");
 	printf("         -h - Show this help\n");
 }
 
@@ -183,6 +199,123 @@ print_found_variants(XklConfigRegistry * config,
 
 }
 
+static void
+count_found_variants(XklConfigRegistry * config,
+		     const XklConfigItem * parent_item,
+		     const XklConfigItem * child_item, gpointer data)
+{
+	(*(guint *) data)++;
+}
+
+static void
+update_config(XklConfigRec * data, const gchar * model,
+	      const gchar * layouts, const gchar * options)
+{
+	if (model != NULL) {
+		if (data->model != NULL)
+			g_free(data->model);
+		data->model = g_strdup(model);
+	}
+
+	if (layouts != NULL) {
+		if (data->layouts != NULL)
+			g_strfreev(data->layouts);
+		if (data->variants != NULL)
+			g_strfreev(data->variants);
+
+		data->layouts = g_new0(char *, 2);
+		data->layouts[0] = g_strdup(layouts);
+		data->variants = g_new0(char *, 2);
+		data->variants[0] = g_strdup("");
+	}
+
+	if (options != NULL) {
+		if (data->options != NULL)
+			g_strfreev(data->options);
+
+		data->options = g_new0(char *, 2);
+		data->options[0] = g_strdup(options);
+	}
+}
+
+static gboolean
+validate_config(const gchar * model, const gchar * layouts,
+		const gchar * options)
+{
+	XklConfigRec *data = xkl_config_rec_new();
+	XklConfigRecValidity validity;
+	GEnumClass *validity_class =
+	    g_type_class_ref(XKL_TYPE_CONFIG_REC_VALIDITY);
+
+	update_config(data, model, layouts, options);
+	xkl_config_rec_dump(stdout, data);
+	validity = xkl_config_rec_validate(data, NULL, TRUE);
+	printf("Validity: %s\n",
+	       g_enum_get_value(validity_class, validity)->value_nick);
+
+	g_type_class_unref(validity_class);
+	g_object_unref(G_OBJECT(data));
+	return validity == XKL_CONFIG_REC_VALID;
+}
+
+static void
+print_export_progress(const XklConfigRecExportJob * job, guint done,
+		      guint total, gpointer data)
+{
+	printf("[%u/%u] %s: %s\n", done, total, job->file_name,
+	       job->written ? "written" :
+	       job->error != NULL ? job->error : "not written");
+}
+
+static void
+config_activated(GObject * source_object, GAsyncResult * res,
+		 gpointer data)
+{
+	GError *error = NULL;
+
+	if (xkl_config_rec_activate_finish
+	    (XKL_ENGINE(source_object), res, &error))
+		xkl_debug(0, "Set the config asynchronously\n");
+	else {
+		xkl_debug(0, "Could not set the config: %s\n",
+			  error->message);
+		g_error_free(error);
+	}
+	g_main_loop_quit((GMainLoop *) data);
+}
+
+#define BENCHMARK_ROUNDS 50
+
+static void
+benchmark_search(XklConfigRegistry * config, const gchar * pattern)
+{
+	gint n_threads, max_threads = g_get_num_processors();
+
+	for (n_threads = 1; n_threads <= max_threads; n_threads++) {
+		guint found = 0;
+		gint64 start;
+		int i;
+
+		xkl_config_registry_set_max_search_threads(config,
+							   n_threads);
+		/* warm up, builds the search data */
+		xkl_config_registry_search_by_pattern(config, pattern,
+						      count_found_variants,
+						      &found);
+		found = 0;
+		start = g_get_monotonic_time();
+		for (i = 0; i < BENCHMARK_ROUNDS; i++)
+			xkl_config_registry_search_by_pattern(config,
+							      pattern,
+							      count_found_variants,
+							      &found);
+		printf("threads: %d, found: %u, %.3f ms per search\n",
+		       n_threads, found / BENCHMARK_ROUNDS,
+		       (g_get_monotonic_time() -
+			start) / 1000.0 / BENCHMARK_ROUNDS);
+	}
+}
+
 int
 main(int argc, char *const argv[])
 {
@@ -193,6 +326,8 @@ main(int argc, char *const argv[])
 	const gchar *layouts = NULL;
 	const gchar *options = NULL;
 	const gchar *pattern = NULL;
+	const gchar *language = NULL;
+	const gchar *registry_file = NULL;
 	int debug_level = -1;
 	int binary = 0;
 	Display *dpy;
@@ -202,7 +337,7 @@ main(int argc, char *const argv[])
 				     G_TYPE_DEBUG_SIGNALS);
 
 	while (1) {
-		c = getopt(argc, argv, "ha:sgm:l:o:d:w:c:p:");
+		c = getopt(argc, argv, "ha:sgm:l:o:d:w:c:p:f:r:b:z:vey");
 		if (c == -1)
 			break;
 		switch (c) {
@@ -219,6 +354,18 @@ main(int argc, char *const argv[])
 			printf("Get the config\n");
 			action = ACTION_GET;
 			break;
+		case 'y':
+			printf("Set the config asynchronously\n");
+			action = ACTION_ASYNC_SET;
+			break;
+		case 'v':
+			printf("Validate the config\n");
+			action = ACTION_VALIDATE;
+			break;
+		case 'e':
+			printf("Export the config\n");
+			action = ACTION_EXPORT;
+			break;
 		case 'm':
 			printf("Model: [%s]\n", model = optarg);
 			break;
@@ -232,6 +379,21 @@ main(int argc, char *const argv[])
 			action = ACTION_SEARCH;
 			printf("Pattern: [%s]\n", pattern = optarg);
 			break;
+		case 'z':
+			action = ACTION_FUZZY_SEARCH;
+			printf("Pattern: [%s]\n", pattern = optarg);
+			break;
+		case 'f':
+			action = ACTION_FILTER;
+			printf("Language: [%s]\n", language = optarg);
+			break;
+		case 'b':
+			action = ACTION_BENCHMARK;
+			printf("Pattern: [%s]\n", pattern = optarg);
+			break;
+		case 'r':
+			printf("Registry: [%s]\n", registry_file = optarg);
+			break;
 		case 'h':
 			print_usage();
 			exit(0);
@@ -257,6 +419,13 @@ main(int argc, char *const argv[])
 	setlocale(LC_ALL, "");
 #endif
 
+	/* the only action which works without X */
+	if (action == ACTION_VALIDATE) {
+		if (debug_level != -1)
+			xkl_set_debug_level(debug_level);
+		exit(validate_config(model, layouts, options) ? 0 : 1);
+	}
+
 	dpy = XOpenDisplay(NULL);
 	if (dpy == NULL) {
 		fprintf(stderr, "Could not open display\n");
@@ -271,7 +440,12 @@ main(int argc, char *const argv[])
 
 		xkl_debug(0, "Xklavier initialized\n");
 		config = xkl_config_registry_get_instance(engine);
-		xkl_config_registry_load(config, TRUE);
+		if (registry_file != NULL)
+			xkl_config_registry_load_from_path(config,
+							   registry_file,
+							   NULL);
+		else
+			xkl_config_registry_load(config, TRUE);
 
 		xkl_debug(0, "Xklavier registry loaded\n");
 		xkl_debug(0, "Backend: [%s]\n",
@@ -348,39 +522,8 @@ main(int argc, char *const argv[])
 			g_object_unref(G_OBJECT(r2));
 			break;
 		case ACTION_SET:
-			if (model != NULL) {
-				if (current_config->model != NULL)
-					g_free(current_config->model);
-				current_config->model = g_strdup(model);
-			}
-
-			if (layouts != NULL) {
-				if (current_config->layouts != NULL)
-					g_strfreev
-					    (current_config->layouts);
-				if (current_config->variants != NULL)
-					g_strfreev
-					    (current_config->variants);
-
-				current_config->layouts =
-				    g_new0(char *, 2);
-				current_config->layouts[0] =
-				    g_strdup(layouts);
-				current_config->variants =
-				    g_new0(char *, 2);
-				current_config->variants[0] = g_strdup("");
-			}
-
-			if (options != NULL) {
-				if (current_config->options != NULL)
-					g_strfreev
-					    (current_config->options);
-
-				current_config->options =
-				    g_new0(char *, 2);
-				current_config->options[0] =
-				    g_strdup(options);
-			}
+			update_config(current_config, model, layouts,
+				      options);
 
 			xkl_debug(0, "New config:\n");
 			xkl_config_rec_dump(stdout, current_config);
@@ -402,12 +545,76 @@ main(int argc, char *const argv[])
 			xkl_debug(0, "The file " PACKAGE "%s is written\n",
 				  binary ? ".xkm" : ".xkb");
 			break;
+		case ACTION_ASYNC_SET:
+			{
+				GMainLoop *loop = g_main_loop_new(NULL,
+								  FALSE);
+				update_config(current_config, model,
+					      layouts, options);
+				xkl_debug(0, "New config:\n");
+				xkl_config_rec_dump(stdout,
+						    current_config);
+				xkl_config_rec_activate_async
+				    (current_config, engine, NULL,
+				     config_activated, loop);
+				g_main_loop_run(loop);
+				g_main_loop_unref(loop);
+			}
+			break;
+		case ACTION_EXPORT:
+			{
+				XklConfigRecExportJob jobs[2];
+				guint written;
+
+				memset(jobs, 0, sizeof jobs);
+				jobs[0].data = jobs[1].data =
+				    current_config;
+				jobs[0].file_name = PACKAGE ".xkm";
+				jobs[0].binary = TRUE;
+				jobs[1].file_name = PACKAGE ".xkb";
+				jobs[1].binary = FALSE;
+				written =
+				    xkl_config_rec_write_to_files(engine,
+								  jobs, 2,
+								  0,
+								  print_export_progress,
+								  NULL);
+				xkl_debug(0, "%u of 2 files are written\n",
+					  written);
+			}
+			break;
 		case ACTION_SEARCH:
 			xkl_config_registry_search_by_pattern(config,
 							      pattern,
 							      (TwoConfigItemsProcessFunc)
 							      print_found_variants,
 							      NULL);
+			break;
+		case ACTION_FUZZY_SEARCH:
+			xkl_config_registry_search_fuzzy(config, pattern, -1,
+							 (TwoConfigItemsProcessFunc)
+							 print_found_variants,
+							 NULL);
+			break;
+		case ACTION_FILTER:
+			{
+				XklConfigFilter *filter =
+				    xkl_config_filter_new
+				    (XKL_CONFIG_FILTER_VARIANTS);
+				xkl_config_filter_set_language(filter,
+							       language);
+				xkl_config_filter_set_extra_item(filter,
+								 FALSE);
+				xkl_config_registry_foreach_filtered(config,
+								     filter,
+								     print_iso_variant,
+								     NULL);
+				xkl_config_filter_free(filter);
+			}
+			break;
+		case ACTION_BENCHMARK:
+			benchmark_search(config, pattern);
+			break;
 		}
 
 		g_object_unref(G_OBJECT(current_config));